@@ -0,0 +1,94 @@
+PARAM_ORG equ 8192
+_RANDOM equ 53770
+_VCOUNT equ 54283
+_WSYNC equ 54282
+_STRIG equ 644
+_DMACTL equ 559
+player__x equ 53248
+player__gfx equ 53261
+player__color equ 53266
+player__size equ 53256
+_GRACTL equ 53277
+_x equ 1536
+__37 equ 1775
+   org $2e0
+   dta a(PARAM_ORG)
+   org PARAM_ORG
+;### stars.atl(17) DMACTL = off
+   lda #0
+   sta _DMACTL
+;### stars.atl(18) GRACTL = off
+   sta _GRACTL
+;### stars.atl(22) for y:video_line 
+   ldx #17
+__lbl14:
+;### stars.atl(23) 	x(y)  = RANDOM
+   lda _RANDOM
+   sta _x-4-13,x
+;### stars.atl(24) 	speed(y) = RANDOM mod 4 + 1
+   lda _RANDOM
+   and #3
+   clc
+   adc #1
+   sta _speed-4-13,x
+;### stars.atl(25) 	col(y)   = RANDOM bitor 3			;make the star color light enough 
+   lda _RANDOM
+   ora #3
+   sta _col-4-13,x
+   inx
+   jne __lbl14
+;### stars.atl(30) player(0).gfx = %00000001
+   lda #1
+   sta player__gfx
+;### stars.atl(31) player(0).size = 0
+   lda #0
+   sta player__size
+   jmp __lbl15
+__lbl19:
+   sta _WSYNC
+__lbl17:
+;### stars.atl(36) 	until VCOUNT = video_line.min 
+   lda _VCOUNT
+   cmp #4
+   jne __lbl19
+__lbl18:
+;### stars.atl(40) 	for y:video_line
+   ldx #17
+__lbl21:
+;### stars.atl(41) 		player(0).color = col(y)
+   lda _col-4-13,x
+   sta player__color
+;### stars.atl(42) 		player(0).x = x(y)
+   ldy _x-4-13,x
+   sty player__x
+;### stars.atl(47) 		x(y) =  lo (x(y) + speed(y))
+   lda _speed-4-13,x
+   sta __37
+   tya
+   clc
+   adc __37
+   sta _x-4-13,x
+   sta _WSYNC
+   inx
+   jne __lbl21
+__lbl15:
+;### stars.atl(33) until STRIG(0) = pressed
+   lda _STRIG
+   jne __lbl17
+__lbl16:
+;### stars.atl(52) player(0).gfx = 0
+   lda #0
+   sta player__gfx
+;### stars.atl(53) DMACTL = dl + playfield 
+   lda #34
+   sta _DMACTL
+__40:
+   jmp __40
+   icl '/tmp/bh/src/atalan/platform/atari/atari.asm'
+   icl '/tmp/bh/src/atalan/cpu/m6502/m6502.asm'
+
+_speed:
+   .ds 239
+_col:
+   .ds 239
+;end
@@ -123,6 +123,20 @@ Bool IntEqN(BigInt * l, Int32 N)
 	return *l == N;
 }
 
+UInt32 IntHash(BigInt * n)
+/*
+Purpose:
+	Return hash of the integer value.
+	Equal integers have equal hash.
+*/
+{
+	UInt64 x = (UInt64)*n;
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	return (UInt32)x;
+}
+
 Bool IntHigherN(BigInt * l, Int32 N)
 {
 	return *l > N;
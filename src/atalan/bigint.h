@@ -38,6 +38,7 @@ Bool IntLowerEq(BigInt * l, BigInt * r);
 Bool IntHigherEq(BigInt * l, BigInt * r);
 
 Bool IntEqN(BigInt * l, Int32 N);
+UInt32 IntHash(BigInt * n);
 Bool IntHigherN(BigInt * l, Int32 N);
 Bool IntLowerN(BigInt * l, Int32 N);
 Bool IntLowerEqN(BigInt * l, Int32 N); 
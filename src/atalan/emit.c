@@ -263,116 +263,279 @@ void EmitVar(Var * var, UInt8 format)
 
 extern Var * MACRO_ARG[26];
 
-void EmitInstr2(Instr * instr, char * str)
+/*
+Emit templates
+==============
+
+Every line emitted by instruction rule is a template like "lda %A+%'B.size".
+Templates are compiled to list of segments when the rule is registered, so we do not need
+to parse the template every time an instruction is emitted.
+
+Segment is either literal text or reference to instruction argument, macro argument or property of macro argument.
+*/
+
+typedef enum {
+	EMIT_SEG_TEXT,			// literal text
+	EMIT_SEG_RESULT,		// %0
+	EMIT_SEG_ARG1,			// %1
+	EMIT_SEG_ARG2,			// %2
+	EMIT_SEG_VAR,			// %A .. %Z
+	EMIT_SEG_COUNT,			// %A.count
+	EMIT_SEG_SIZE,			// %A.size
+	EMIT_SEG_ELEMSIZE,		// %A.elemsize  %A.item.size
+	EMIT_SEG_STEP,			// %A.step
+	EMIT_SEG_INDEX_MIN		// %A.index.min
+} EmitSegmentKind;
+
+typedef struct {
+	UInt8  kind;
+	UInt8  format;			// 1 if the argument should be emitted as string constant (%')
+	UInt8  arg_no;			// index of macro argument (0 = A)
+	UInt16 len;				// length of literal text
+	char * text;			// literal text
+} EmitSegment;
+
+struct EmitTemplateTag {
+	EmitTemplate * next;	// template of next line
+	UInt16 count;			// number of segments
+	EmitSegment seg[1];
+};
+
+static EmitSegment * EmitTemplateAddSegment(EmitSegment * seg, UInt16 * p_count, UInt8 kind, UInt8 format, UInt8 arg_no)
 {
-	Var * var;
-	UInt8 format = 0;
-	char * s, c;
-	UInt32 n;
-	BigInt bn;
-	BigInt * pn;
-	s = str;
+	seg += *p_count;
+	(*p_count)++;
+	seg->kind   = kind;
+	seg->format = format;
+	seg->arg_no = arg_no;
+	seg->len    = 0;
+	seg->text   = NULL;
+	return seg;
+}
 
-	if (instr->op == INSTR_LINE) {
-		PrintColor(BLUE+LIGHT);
+static void EmitTemplateAddChar(EmitSegment * seg, UInt16 * p_count, char ** p_text, char c)
+/*
+Purpose:
+	Append character to literal text (starting new text segment if necessary).
+*/
+{
+	EmitSegment * last;
+	last = (*p_count > 0) ? &seg[*p_count - 1] : NULL;
+	if (last == NULL || last->kind != EMIT_SEG_TEXT) {
+		last = EmitTemplateAddSegment(seg, p_count, EMIT_SEG_TEXT, 0, 0);
+		last->text = *p_text;
 	}
+	*(*p_text)++ = c;
+	last->len++;
+}
+
+EmitTemplate * EmitTemplateCompile(char * str)
+/*
+Purpose:
+	Compile emit template.
+	The template is parsed exactly the same way it used to be interpreted when emitting.
+*/
+{
+	EmitTemplate * tmpl;
+	EmitSegment * seg;
+	UInt16 count, len;
+	UInt8 format = 0;
+	UInt8 arg_no;
+	char * s, c, * text;
+
+	// Every template character creates at most one segment and one character of literal text
+	len = StrLen(str);
+	tmpl = (EmitTemplate *)MemAllocEmpty(sizeof(EmitTemplate) + sizeof(EmitSegment) * len + len + 1);
+	seg  = tmpl->seg;
+	text = (char *)&tmpl->seg[len + 1];
+	count = 0;
 
-	while(c = *s++) {		
+	s = str;
+	while((c = *s++)) {
 		if (c == '%') {
 			c = *s++;
+			if (c == 0) break;
 			if (c == '\'') {
 				format = 1;
 				c = *s++;
+				if (c == 0) break;
 			}
-			
+
 			if (c >='A' && c<='Z') {
-				var = MACRO_ARG[c-'A'];
+				arg_no = c - 'A';
 				// Variable properties
 				if (*s == '.') {
 					s++;
 					if (StrEqualPrefix(s, "count", 5)) {
-						VarCount(var, &bn);
-						EmitBigInt(&bn);
-						s+= 5;
+						EmitTemplateAddSegment(seg, &count, EMIT_SEG_COUNT, format, arg_no);
+						s += 5;
 						continue;
 					} else if (StrEqualPrefix(s, "size", 4)) {
-						n = VarByteSize(var);
-						EmitInt(n);
-						s+= 4;
+						EmitTemplateAddSegment(seg, &count, EMIT_SEG_SIZE, format, arg_no);
+						s += 4;
 						continue;
 					} else if (StrEqualPrefix(s, "elemsize", 8) || StrEqualPrefix(s, "item.size", 9)) {
+						EmitTemplateAddSegment(seg, &count, EMIT_SEG_ELEMSIZE, format, arg_no);
 						s += 8;
-						if (var->type->variant == TYPE_ARRAY) {
-							n = TypeSize(var->type->element);
-						} else {
-							n = 0;
-						}
-						EmitInt(n);
 						continue;
 					} if (StrEqualPrefix(s, "step", 4)) {
+						EmitTemplateAddSegment(seg, &count, EMIT_SEG_STEP, format, arg_no);
 						s += 4;
-						n = 1;
-						if (var->type->variant == TYPE_ARRAY) {
-							n = var->type->step;
-						}
-						EmitInt(n);
 						continue;
-
 					} else if (StrEqualPrefix(s, "index.min", 9)) {
+						EmitTemplateAddSegment(seg, &count, EMIT_SEG_INDEX_MIN, format, arg_no);
 						s += 9;
-						if (var->type->variant == TYPE_ARRAY) {
-							pn = &var->type->index->range.min;
-						} else {
-							pn = Int0();
-						}
-						EmitBigInt(pn);
 						continue;
 					}
 					s--;
 				}
-				EmitVar(var, format); continue;
+				EmitTemplateAddSegment(seg, &count, EMIT_SEG_VAR, format, arg_no);
+				continue;
 			}
 
 			switch(c) {
-				case '0': 
-					EmitVar(instr->result, format); continue;
-				case '1': 
-					if (instr->op != INSTR_LINE) {
-						EmitVar(instr->arg1, format); 
-					} else {
-						EmitInt(instr->line_no);
-					}
-					continue;
-				case '2': 
-					if (instr->op != INSTR_LINE) {
-						EmitVar(instr->arg2, format); 
-					} else {
-						EmitStr(instr->line);
-					}
-					continue;
+				case '0': EmitTemplateAddSegment(seg, &count, EMIT_SEG_RESULT, format, 0); continue;
+				case '1': EmitTemplateAddSegment(seg, &count, EMIT_SEG_ARG1, format, 0); continue;
+				case '2': EmitTemplateAddSegment(seg, &count, EMIT_SEG_ARG2, format, 0); continue;
 				case '@': break;
 				case 't': c = '\t'; break;
 			}
 		}
-		EmitChar(c);
+		EmitTemplateAddChar(seg, &count, &text, c);
+	}
+	tmpl->count = count;
+	return tmpl;
+}
+
+void EmitRuleCompile(Rule * rule)
+/*
+Purpose:
+	Compile templates of all lines emitted by the instruction rule.
+*/
+{
+	Instr * to;
+	EmitTemplate * tmpl, * last;
+
+	last = NULL;
+	for(to = rule->to->first; to != NULL; to = to->next) {
+		tmpl = EmitTemplateCompile(to->arg1->str);
+		if (last == NULL) {
+			rule->emit = tmpl;
+		} else {
+			last->next = tmpl;
+		}
+		last = tmpl;
+	}
+}
+
+void EmitInstr2(Instr * instr, EmitTemplate * tmpl)
+{
+	Var * var;
+	EmitSegment * seg, * end;
+	UInt32 n;
+	UInt16 k;
+	BigInt bn;
+	BigInt * pn;
+
+	if (instr->op == INSTR_LINE) {
+		PrintColor(BLUE+LIGHT);
+	}
+
+	for(seg = tmpl->seg, end = tmpl->seg + tmpl->count; seg < end; seg++) {
+		var = MACRO_ARG[seg->arg_no];
+		switch(seg->kind) {
+		case EMIT_SEG_TEXT:
+			for(k = 0; k < seg->len; k++) {
+				EmitChar(seg->text[k]);
+			}
+			break;
+
+		case EMIT_SEG_RESULT:
+			EmitVar(instr->result, seg->format);
+			break;
+
+		case EMIT_SEG_ARG1:
+			if (instr->op != INSTR_LINE) {
+				EmitVar(instr->arg1, seg->format); 
+			} else {
+				EmitInt(instr->line_no);
+			}
+			break;
+
+		case EMIT_SEG_ARG2:
+			if (instr->op != INSTR_LINE) {
+				EmitVar(instr->arg2, seg->format); 
+			} else {
+				EmitStr(instr->line);
+			}
+			break;
+
+		case EMIT_SEG_VAR:
+			EmitVar(var, seg->format);
+			break;
+
+		case EMIT_SEG_COUNT:
+			VarCount(var, &bn);
+			EmitBigInt(&bn);
+			break;
+
+		case EMIT_SEG_SIZE:
+			n = VarByteSize(var);
+			EmitInt(n);
+			break;
+
+		case EMIT_SEG_ELEMSIZE:
+			if (var->type->variant == TYPE_ARRAY) {
+				n = TypeSize(var->type->element);
+			} else {
+				n = 0;
+			}
+			EmitInt(n);
+			break;
+
+		case EMIT_SEG_STEP:
+			n = 1;
+			if (var->type->variant == TYPE_ARRAY) {
+				n = var->type->step;
+			}
+			EmitInt(n);
+			break;
+
+		case EMIT_SEG_INDEX_MIN:
+			if (var->type->variant == TYPE_ARRAY) {
+				pn = &var->type->index->range.min;
+			} else {
+				pn = Int0();
+			}
+			EmitBigInt(pn);
+			break;
+		}
 	}
+
 	if (instr->op == INSTR_LINE) {
 		PrintColor(RED+GREEN+BLUE);
 	}
 }
 
+static EmitTemplate * RuleEmitTemplate(Rule * rule)
+{
+	// Rules are compiled when registered, but there may be rules not registered using RuleRegister
+	if (rule->emit == NULL) EmitRuleCompile(rule);
+	return rule->emit;
+}
+
 extern Bool RULE_MATCH_BREAK;
 
 Bool EmitInstr(Instr * i)
 {
 	Rule * rule;
-	Instr * to;
+	EmitTemplate * tmpl;
 
 	rule = InstrRule(i);
 
 	if (rule != NULL) {
-		for(to = rule->to->first; to != NULL; to = to->next) {
-			EmitInstr2(i, to->arg1->str);
+		for(tmpl = RuleEmitTemplate(rule); tmpl != NULL; tmpl = tmpl->next) {
+			EmitInstr2(i, tmpl);
 			EmitChar(EOL);
 		}
 		return true;
@@ -386,13 +549,13 @@ Bool EmitInstr(Instr * i)
 Bool EmitInstrInline(Instr * i)
 {
 	Rule * rule;
-	Instr * to;
+	EmitTemplate * tmpl;
 
 	rule = InstrRule(i);
 
 	if (rule != NULL) {
-		for(to = rule->to->first; to != NULL; to = to->next) {
-			EmitInstr2(i, to->arg1->str);
+		for(tmpl = RuleEmitTemplate(rule); tmpl != NULL; tmpl = tmpl->next) {
+			EmitInstr2(i, tmpl);
 		}
 		return true;
 	} else {
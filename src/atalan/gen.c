@@ -435,7 +435,7 @@ void GenerateInit()
 
 	memset(&ROOT_PROC, 0, sizeof(ROOT_PROC));
 	type = TypeAlloc(TYPE_PROC);
-	ROOT_PROC.name = "root";
+	ROOT_PROC.name = NameAtom("root");
 	ROOT_PROC.idx  = 0;
 	ROOT_PROC.type = type;		//&ROOT_PROC_TYPE;
 	ROOT_PROC.instr = NULL;
@@ -13,6 +13,12 @@ Licensed under the MIT license: http://www.opensource.org/licenses/mit-license.p
 extern Var * VARS;		// global variables
 GLOBAL Instr NULL_INSTR;
 GLOBAL Instr * InstrNull;
+GLOBAL MemArena INSTR_ARENA;	// memory for instructions
+GLOBAL Instr * FREE_INSTR;		// list of released instructions (linked using next)
+GLOBAL UInt32 INSTR_CHANGE_CNT;	// number of allocated, released or rewritten instructions (see PassRun)
+GLOBAL UInt32 CFG_STAMP;			// incremented every time blocks or jumps between them change (see MarkLoops)
+GLOBAL UInt32 BLOCK_STAMP;			// incremented every time optimization pass is started
+GLOBAL UInt32 BLOCK_DIRTY_SINCE;	// blocks modified at this stamp or later are dirty (0 means all blocks are dirty)
 
 extern Var * MACRO_ARG[MACRO_ARG_CNT];
 
@@ -190,7 +196,10 @@ Blocks may be nested, because procedures may be nested.
 
 InstrBlock * InstrBlockAlloc()
 {
-	return MemAllocStruct(InstrBlock);
+	InstrBlock * blk = MemAllocStruct(InstrBlock);
+	blk->changed = BLOCK_STAMP;
+	CFG_STAMP++;
+	return blk;
 }
 
 void InstrBlockFree(InstrBlock * blk)
@@ -206,6 +215,65 @@ void InstrBlockFree(InstrBlock * blk)
 	}
 }
 
+/*
+
+Dirty blocks
+
+Every modification of the block stores current BLOCK_STAMP to the block.
+Pass manager increments the stamp every time it runs a pass and remembers the stamp for every pass and procedure.
+Pass that supports it then processes only blocks modified since it's last run (BLOCK_DIRTY_SINCE).
+
+*/
+
+void InstrBlockChanged(InstrBlock * blk)
+{
+	if (blk != NULL) {
+		blk->changed = BLOCK_STAMP;
+	}
+}
+
+void ProcChanged(Var * proc)
+/*
+Purpose:
+	Mark all blocks of the procedure as modified.
+	Used after passes, that modify the code without reporting modified blocks.
+*/
+{
+	InstrBlock * blk;
+	for(blk = proc->instr; blk != NULL; blk = blk->next) {
+		blk->changed = BLOCK_STAMP;
+	}
+}
+
+void MarkDirtyBlocks(Var * proc, Bool reaching)
+/*
+Purpose:
+	Set dirty flag of blocks modified since BLOCK_DIRTY_SINCE.
+	If reaching is true, blocks from which some dirty block may be reached are marked dirty too.
+	This is necessary for backward data flow analysis (like live variables), as modification of
+	the block may change the result for any block preceding it.
+*/
+{
+	InstrBlock * blk;
+	Bool modified;
+
+	for(blk = proc->instr; blk != NULL; blk = blk->next) {
+		blk->dirty = blk->changed >= BLOCK_DIRTY_SINCE;
+	}
+
+	if (reaching) {
+		do {
+			modified = false;
+			for(blk = proc->instr; blk != NULL; blk = blk->next) {
+				if (!blk->dirty && ((blk->to != NULL && blk->to->dirty) || (blk->cond_to != NULL && blk->cond_to->dirty))) {
+					blk->dirty = true;
+					modified = true;
+				}
+			}
+		} while(modified);
+	}
+}
+
 UInt32 InstrBlockInstrCount(InstrBlock * blk)
 /*
 Purpose:
@@ -256,20 +324,15 @@ Purpose:
 }
 
 InstrOp InstrFind(char * name)
+/*
+Purpose:
+	Find instruction with specified name.
+	Instruction names are registered in name table by InstrInit, so we do not have to compare the name with all instructions.
+*/
 {
-	UInt16 i;
-	InstrInfo * ii = &INSTR_INFO[1];
-
-	ASSERT(INSTR_NULL == 0);
-
-	for(i=1; i<= INSTR_CNT; i++, ii++) {
-		if (ii->name != NULL && StrEqual(name, ii->name)) {
-			ASSERT(i == ii->op);
-			return (InstrOp)i;
-		}
-	}
-
-	return INSTR_NULL;
+	char * key = NameFind(name);
+	if (key == NULL) return INSTR_NULL;
+	return NAME_OF(key)->op;
 }
 
 char * OpSymbol(InstrOp op)
@@ -282,6 +345,7 @@ void InstrDetach(InstrBlock * blk, Instr * first, Instr * last)
 	Instr * next;
 
 	if (blk != NULL && first != NULL) {
+		InstrBlockChanged(blk);
 
 		next = last->next;
 		if (first->prev != NULL) {
@@ -304,6 +368,7 @@ void InstrDetach(InstrBlock * blk, Instr * first, Instr * last)
 void InstrAttach(InstrBlock * blk, Instr * before, Instr * first, Instr * last)
 {
 	if (first == NULL) return;
+	InstrBlockChanged(blk);
 	if (before == NULL) {
 		first->prev = blk->last;
 		if (blk->last != NULL) {
@@ -335,13 +400,34 @@ Purpose:
 	InstrAttach(to, before, first, last);
 }
 
+Instr * InstrAlloc()
+/*
+Purpose:
+	Allocate new instruction filled with zeroes.
+	Instructions are allocated from arena, released instructions are reused.
+*/
+{
+	Instr * i;
+	i = FREE_INSTR;
+	if (i != NULL) {
+		FREE_INSTR = i->next;
+		MemEmpty(i, sizeof(Instr));
+	} else {
+		i = MemArenaAllocStruct(&INSTR_ARENA, Instr);
+	}
+	INSTR_CHANGE_CNT++;
+	return i;
+}
+
 void InstrFree(Instr * i)
 {
 	if (i != NULL) {
 		if (i->op == INSTR_LINE) {
 //			free(i->line);
 		}
-		free(i);
+		i->next = FREE_INSTR;
+		FREE_INSTR = i;
+		INSTR_CHANGE_CNT++;
 	}
 }
 
@@ -373,7 +459,9 @@ Purpose:
 			blk->last = i->prev;
 		}
 
+		if (VAR_USE_VALID) InstrUseAdd(i, -1);
 		InstrFree(i);
+		InstrBlockChanged(blk);
 	}
 	return next;
 }
@@ -385,7 +473,7 @@ Purpose:
 	If before instruction is NULL, instruction is inserted to the end of block.
 */
 {
-	Instr * i = MemAllocStruct(Instr);
+	Instr * i = InstrAlloc();
 	i->op = op;
 	i->result = result;
 	i->arg1 = arg1;
@@ -393,6 +481,7 @@ Purpose:
 	i->line_pos = 0;
 
 	InstrAttach(blk, before, i, i);
+	if (VAR_USE_VALID) InstrUseAdd(i, 1);
 
 	return i;
 }
@@ -1056,6 +1145,7 @@ void PrintProcFlags(Var * proc, UInt32 flags)
 void InstrInit()
 {
 	InstrOp op;
+	Name * nm;
 
 	MemEmptyVar(NULL_INSTR);
 	NULL_INSTR.op = INSTR_NULL;
@@ -1063,6 +1153,10 @@ void InstrInit()
 
 	for(op=INSTR_NULL; op < INSTR_CNT; op++) {
 		ASSERT(INSTR_INFO[op].op == op);
+		if (op != INSTR_NULL && INSTR_INFO[op].name != NULL) {
+			nm = NameIntern(INSTR_INFO[op].name)->canon;
+			if (nm->op == INSTR_NULL) nm->op = op;
+		}
 	}
 }
 
@@ -1,4 +1,5 @@
 #include "../common/common.h"
+#include <stddef.h>
 
 typedef struct VarTag Var;
 typedef struct LocTag Loc;
@@ -142,6 +143,7 @@ typedef struct {
 	UInt32   n;
 	FILE * f;
 	Bool   ignore_keywords;
+	struct NameTag * name;		// interned name of identifier in NAME (NULL if the token is not an identifier)
 } Lexer;
 
 Bool SrcOpen(char * name, Bool parse_options);
@@ -312,24 +314,32 @@ void PlatformError(char * text);
 
  Names are managed separatelly from variables.
  Variables do not have to be named, but if they are, they contain reference to a name.
+ Names are interned, so variable names may be compared using pointer comparison.
 
 *********************************************************/
 
-//TODO: Names are no used yet...
-
 typedef struct NameTag Name;
 
-typedef struct NameTag {
+struct NameTag {
 
-	Name * next;			// next name
-	char * name;
+	Name * next;			// next name in the same bucket of name table
+	Name * canon;			// canonical name (first spelling of this name, may be this name)
+	UInt32 hash;			// case insensitive hash of the name
+	Token  token;			// keyword token, if the name is keyword (TOKEN_VOID otherwise), used only in canonical name
+	InstrOp op;				// instruction with this name (INSTR_NULL otherwise), used only in canonical name
+	char   text[1];			// text of the name (allocated together with the name)
+};
 
-	// Position, where the name was declared
+#define NAME_OF(str) ((Name *)((str) - offsetof(Name, text)))
 
-	Var *   file;			// file in which the name has been defined
-	LineNo  line_no;		// line of number, on which the name has been defined
-	LinePos line_pos;		// position on line at which the name has been declared
-};
+// Key of interned name. Two names are equal, if their keys are the same pointer.
+#define NameKey(str) ((str) == NULL ? NULL : NAME_OF(str)->canon->text)
+
+void NameInit();
+Name * NameIntern(char * str);
+char * NameAtom(char * str);
+char * NameFind(char * str);
+char * NameUnique(char * str);
 
 /*********************************************************
 
@@ -529,8 +539,9 @@ typedef enum {
 
 #define VarLabelDefined    32
 
+#define VarValueKnown      128		// variable is in list of variables with known value (see OptimizeValues)
+
 typedef unsigned int VarIdx;
-//typedef char * Name;
 
 typedef UInt8 VarFlags;
 
@@ -540,7 +551,7 @@ struct VarTag {
 	VarSubmode submode;
 
 	// Variable identification (name,idx,scope)
-	char *	name;
+	char *	name;	 // interned name (see NameAtom), names are compared using NameKey
 	VarIdx  idx;	 // two variables with same name but different index may exist
 					 // 0 means no index, 1 means index 1 etc.
 					 // variable name "x1" is automatically converted to x,1
@@ -573,12 +584,17 @@ struct VarTag {
 	UInt16	read;			// how many times some instruction reads this variable (if 0, this is unused)
 	UInt16	write;			// how many times some instruction writes this variable (if 1 this is constant)
 
-	UInt16  set_index;		// index in current set
+	UInt32  set_index;		// index in current set
 
 	Var  *  next;			// next variable in chain
+	UInt32  seq_no;			// order in which the variable has been added to chain of variables
+	Var  *  next_hash[3];	// next variable in bucket of variable index (VAR_INDEX_SCOPE, VAR_INDEX_NAME, VAR_INDEX_OP)
 
 	Var  *  next_in_scope;  // in future, this will be replaced by 'next'
-	Var  *  subscope;
+	Var  *  subscope;		// first variable in this scope
+	Var  *  last_subscope;	// last variable in this scope
+	UInt32  subscope_count;	// number of variables in this scope
+	Var  ** locals;			// array of variables in this scope built by VarLocals (NULL if not built)
 };
 
 /*
@@ -621,7 +637,7 @@ Unused variables are kept in a list usinf next_in_scope.
 
 */
 
-#define VAR_BLOCK_CAPACITY 10
+#define VAR_BLOCK_CAPACITY 256
 
 typedef struct VarBlockTag VarBlock;
 
@@ -785,6 +801,7 @@ void ExitScope();
 
 Var * VarAllocUnused();
 void VarSetScope(Var * var, Var * scope);
+void VarChangeScope(Var * var, Var * scope);
 
 Var * VarInt(long n);
 Var * VarN(BigInt * n);
@@ -867,6 +884,7 @@ Var * NextArg(Var * proc, Var * arg, VarSubmode submode);
 
 Var * VarFirstLocal(Var * scope);
 Var * VarNextLocal(Var * scope, Var * local);
+Var ** VarLocals(Var * scope, UInt32 * p_count);
 
 Var * VarNewElement(Var * arr, Var * idx);
 Var * VarNewByteElement(Var * arr, Var * idx);
@@ -875,6 +893,8 @@ Var * VarNewDeref(Var * var);
 Var * VarNewRange(Var * min, Var * max);
 Var * VarNewTuple(Var * left, Var * right);
 Var * VarNewOp(InstrOp op, Var * left, Var * right);
+Var * VarFindOp(InstrOp op, Var * left, Var * right);
+void VarSetOpArgs(Var * var, Var * left, Var * right);
 
 Var * VarEvalConst(Var * var);
 
@@ -915,20 +935,23 @@ typedef struct {
 } VarTuple;
 
 typedef struct VarSetTag {
-	VarTuple * arr;
-	UInt16     count;
-	UInt16     capacity;
+	VarTuple * arr;			// items in the order in which they were added
+	UInt32     count;
+	UInt32     capacity;
+	UInt32 *   hash;		// open addressing hash table (index + 1 of item in arr, 0 = empty), NULL for small sets
+	UInt32     hash_size;	// number of slots in hash table (power of two)
 };
 
 #define VarSetCount(set) ((set)->count)
 
 void VarSetInit(VarSet * set);
 Var * VarSetFind(VarSet * set, Var * key);
+Bool VarSetFindIndex(VarSet * set, Var * key, UInt32 * p_index);
 void VarSetAdd(VarSet * set, Var * key, Var * var);
 Var * VarSetRemove(VarSet * set, Var * key);
 void VarSetEmpty(VarSet * set);
 void VarSetCleanup(VarSet * set);
-VarTuple * VarSetItem(VarSet * set, UInt16 index);
+VarTuple * VarSetItem(VarSet * set, UInt32 index);
 
 void VarSetPrint(VarSet * set);
 
@@ -971,11 +994,16 @@ InstrOp OpRelSwap(InstrOp op);
  Expression represents tree of expressions.
  op defines operation used to compute the result of the expression.
  INSTR_VAR represents expression representing value of variable or reference to variable.
+
+ Expressions are shared (see ExpNew), so two expressions with same operation and same arguments
+ are the same object and they have the same value number.
 */
 
 struct ExpTag {
 	UInt8     flags;
 	InstrOp   op;			// operation
+	UInt32    vn;			// value number (order in which the expression has been created)
+	Exp *     next_hash;	// next expression in the same bucket of value table
 	union {
 		Exp * arg[2];		// op != INSTR_VAR
 		Var * var;			// op == INSTR_VAR
@@ -1040,15 +1068,10 @@ struct LocTag {
 };
 
 typedef struct {
-	Loc defs[64];
-	UInt16 count;
+	Loc * defs;
+	UInt32 count;
 } Defs;
 
-void DefsAdd(Defs * defs, InstrBlock * blk, Instr * i);
-void DefsInit(Defs * defs);
-
-void ReachingDefs(Var * proc, Var * var, Loc * loc, Defs * defs);
-
 #define InstrInvariant 1
 #define InstrLoopDep 2
 
@@ -1084,23 +1107,43 @@ struct InstrBlockTag {
 	InstrBlock * callers;		// list of blocks calling this block (excluding from)
 	InstrBlock * next_caller;	// next caller in the chain
 
-//	InstrBlock * loop_end;
+	// Dominator tree and loop nesting forest (see MarkLoops)
+	InstrBlock * idom;			// immediate dominator of the block (NULL for procedure entry and unreachable blocks)
+	InstrBlock * loop_header;	// header of the innermost loop containing the block (loop header refers to itself)
+	InstrBlock * loop_parent;	// for loop header, header of the enclosing loop
+	InstrBlock * loop_end;		// for loop header, last block of the loop, if the loop is continuous sequence of blocks
+								// starting with the header and ending with jump to the header (NULL otherwise)
 	JumpType     jump_type;		// whether this is end of loop or some other type of branch
+	UInt16       loop_depth;	// number of loops containing the block
 
 	Var * label;				// label that starts the block
 	Bool  processed;
+	UInt32 order;				// position of the block in order used by data flow analysis
 	Type * type;				// type computed in this block for variable when inferring types
 	Instr * first, * last;		// first and last instruction of the block
 	void * analysis_data;
+	UInt32 changed;				// value of BLOCK_STAMP when the block was last modified
+	Bool   dirty;				// block must be processed by current optimization pass (see MarkDirtyBlocks)
 };
 
 InstrBlock * InstrBlockAlloc();
 
+extern UInt32 BLOCK_STAMP;
+extern UInt32 BLOCK_DIRTY_SINCE;
+extern UInt32 CFG_STAMP;
+
+void InstrBlockChanged(InstrBlock * blk);
+void ProcChanged(Var * proc);
+void MarkDirtyBlocks(Var * proc, Bool reaching);
+
 void InstrInit();
 void InstrPrint(Instr * i);
 void InstrPrintInline(Instr * i);
+Instr * InstrAlloc();
 void InstrFree(Instr * i);
 
+extern UInt32 INSTR_CHANGE_CNT;
+
 char * OpSymbol(InstrOp op);
 
 #define PrintInferredTypes 1
@@ -1142,6 +1185,14 @@ extern Var * SCOPE;		// currently parsed variable (procedure, macro)
 void InstrVarUse(InstrBlock * code, InstrBlock * end);
 void VarUse();
 
+extern Bool VAR_USE_VALID;
+
+void InstrUseAdd(Instr * i, Int16 n);
+void VarUseUpdate();
+#ifdef DEBUG
+void VarUseCheck();
+#endif
+
 Var * InstrEvalConst(InstrOp op, Var * arg1, Var * arg2);
 Var * InstrEvalAlgebraic(InstrOp op, Var * arg1, Var * arg2);
 
@@ -1246,6 +1297,8 @@ struct RuleArgTag {
 							        // Type of that variable must be TYPE_ARRAY
 };
 
+typedef struct EmitTemplateTag EmitTemplate;
+
 struct RuleTag {
 	Rule * next;
 	Var *  file;			// file in which the rule has been defined
@@ -1256,6 +1309,10 @@ struct RuleTag {
 	InstrBlock * to;
 	Var * flags;			// for instruction rule, this is variable with flag or flags (tuple) that are modified, when this instruction is executed
 	UInt8 cycles;			// How many cycles the instruction uses.
+	UInt8 size;				// How many bytes the encoded instruction occupies (0 if not specified in the rule, see RuleCost).
+	UInt32 attempt_cnt;		// how many times has the rule been tried (see RuleStatsPrint)
+	UInt32 match_cnt;		// how many times has the rule matched
+	EmitTemplate * emit;	// for instruction rule, compiled templates of emitted lines (see EmitRuleCompile)
 };
 
 
@@ -1268,8 +1325,11 @@ Rules are stored in rule sets. We have three sets of rules:
 
 */
 
+typedef struct RuleIndexTag RuleIndex;
+
 typedef struct {
 	Rule * rules[INSTR_CNT];
+	RuleIndex * index[INSTR_CNT];		// compiled index of rules for the operation (built when first needed)
 } RuleSet;
 
 void RuleSetInit(RuleSet * ruleset);
@@ -1279,6 +1339,25 @@ Rule * RuleSetFindRule(RuleSet * ruleset, InstrOp op, Var * result, Var * arg1,
 void GenMatchedRule(Rule * rule);
 
 void RuleRegister(Rule * rule);
+void RuleCacheInvalidate();
+void RuleCachePrintStats();
+void RuleStatsPrint();
+
+/*
+Instructions are compared using cost computed from rule cycles and size (see RuleCost).
+The way the cost is computed is selected by optimization goal.
+*/
+
+typedef enum {
+	GOAL_SPEED,			// -ot      minimize number of cycles (default)
+	GOAL_SIZE,			// -os      minimize code size, cycles decide only between instructions of the same size
+	GOAL_WEIGHTED		// -ow <n>  one byte of code is worth n cycles, cycles spent in loops are more expensive
+} OptimizeGoal;
+
+extern OptimizeGoal OPTIMIZE_GOAL;
+extern UInt16 OPTIMIZE_BYTE_COST;
+
+UInt32 RuleCost(Rule * rule, UInt16 loop_depth);
 //Bool RuleMatch(Rule * rule, Instr * i);
 
 #define GENERATE 0
@@ -1355,22 +1434,81 @@ Result:
 	Return true, if there was some change in the block information, false otherwise.
 */
 
-void DataFlowAnalysis(Var * proc, AnalyzeBlockFn block_fn, void * info);
+typedef enum {
+	DATAFLOW_FORWARD,		// information flows from predecessors to successors
+	DATAFLOW_BACKWARD		// information flows from successors to predecessors
+} DataFlowDirection;
+
+void DataFlowAnalysis(Var * proc, DataFlowDirection dir, AnalyzeBlockFn block_fn, void * info);
+void LoopForest(Var * proc);
+Bool BlockDominates(InstrBlock * dom, InstrBlock * blk);
 
-typedef UInt8 * LiveSet;		// VarLive, VarDead, VarUndefined
+/*
+Live set is bit set of variables indexed by their set_index (bit 1 means VarLive, 0 VarDead).
+*/
+
+typedef UInt64 LiveWord;
+typedef LiveWord * LiveSet;
+
+#define LIVE_WORD_BITS 64
+#define LiveSetWords(count) (((count) + LIVE_WORD_BITS - 1) / LIVE_WORD_BITS)
+#define LiveSetTest(set, n)    ((((set)[(n) / LIVE_WORD_BITS]) >> ((n) % LIVE_WORD_BITS)) & 1)
+#define LiveSetInclude(set, n) ((set)[(n) / LIVE_WORD_BITS] |= (LiveWord)1 << ((n) % LIVE_WORD_BITS))
+#define LiveSetExclude(set, n) ((set)[(n) / LIVE_WORD_BITS] &= ~((LiveWord)1 << ((n) % LIVE_WORD_BITS)))
+
+LiveSet LiveSetAlloc(MemArena * arena, UInt32 count);
+void LiveSetMark(LiveSet set, UInt32 n, UInt8 mark);
+void LiveSetClear(LiveSet set, UInt32 count);
+void LiveSetFill(LiveSet set, UInt32 count);
+void LiveSetCopy(LiveSet dest, LiveSet src, UInt32 count);
+void LiveSetUnion(LiveSet dest, LiveSet src, UInt32 count);
+void LiveSetIntersect(LiveSet dest, LiveSet src, UInt32 count);
+void LiveSetDifference(LiveSet dest, LiveSet src, UInt32 count);
+Bool LiveSetEqual(LiveSet l, LiveSet r, UInt32 count);
+UInt32 LiveSetNext(LiveSet set, UInt32 count, UInt32 n);
+
+#define FOR_EACH_LIVE(SET, COUNT, N) for(N = LiveSetNext(SET, COUNT, 0); N < (COUNT); N = LiveSetNext(SET, COUNT, N+1)) {
+#define NEXT_LIVE }
 
 void LiveVariableAnalysis(Var * proc);
 void FreeLiveVariableAnalysis(Var * proc);
 
+/*
+Reaching definitions are computed once for procedure (see ReachingDefsAnalysis) and queries are answered by lookup.
+Definitions of one variable have consecutive numbers, sets of definitions are live sets indexed by definition number.
+*/
+
+typedef struct {
+	Var *     proc;			// procedure, for which the definitions have been computed (NULL if not computed)
+	UInt32    stamp;		// value of CFG_STAMP when the definitions have been computed
+	UInt32    count;		// number of definitions
+	Loc *     defs;			// definitions of the procedure
+	VarSet    vars;			// defined variables
+	UInt32 *  var_defs;		// number of first definition of every variable (indexed by index in vars)
+	LiveSet * in;			// definitions reaching start of block (indexed by seq_no - 1)
+	LiveSet * out;			// definitions reaching end of block
+	UInt32 *  found;		// numbers of definitions found by query
+	UInt8 *   mark;
+	Loc *     result;		// definitions returned by query
+	MemArena  arena;
+} ReachDefs;
+
+void ReachingDefsInit(ReachDefs * rd);
+void ReachingDefsAnalysis(Var * proc, ReachDefs * rd);
+void FreeReachingDefs(ReachDefs * rd);
+void ReachingDefs(ReachDefs * rd, Var * var, Loc * loc, Defs * defs);
+void NextDefs(ReachDefs * rd, Var * var, Loc * loc, Defs * defs);
+Bool DefsReach(ReachDefs * rd, Var * var, Loc * from, Loc * to);
+
 /*************************************************************
 
  Optimize phase
 
 *************************************************************/
 
-void OptimizeDataFlowBack(Var * proc, AnalyzeBlockFn block_fn, void * info);
 
 void ResetValues();
+void ExpCleanup();
 
 Bool VarUsesVar(Var * var, Var * test_var);
 Bool VarModifiesVar(Var * var, Var * test_var);
@@ -1392,12 +1530,13 @@ UInt8 VarIsLiveInBlock(Var * proc, InstrBlock * block, Var * var);
 void MarkBlockAsUnprocessed(InstrBlock * block);
 
 
-void ProcOptimize(Var * proc);
 void GenerateBasicBlocks(Var * proc);
+void LinkBlocks(Var * proc);
 void MarkLoops(Var * proc);
 
 Bool OptimizeLive(Var * proc);
 Bool OptimizeLive2(Var * proc);
+Bool VarDereferences(Var * var);
 
 Bool OptimizeValues(Var * proc);
 Bool OptimizeVarMerge(Var * proc);
@@ -1412,9 +1551,20 @@ void AllocateVariables(Var * proc);
 
 void OptimizeProcInline(Var * proc);
 
+void ProcessUsedProc(void (*process)(Var * proc));
+
+// Pass manager
+
+extern UInt16 PASS_ITERATIONS_MAX;
+
+Bool PassPipelineParse(char * text);
+void PassPipelineRun();
+void PassStatsPrint();
+
 void LoopPreheader(Var * proc, InstrBlock * header, Loc * loc);
 
 void OptimizeLoopShift(Var * proc);
+void OptimizeConstProp(Var * proc);
 
 void InstrExecute(InstrBlock * blk);
 
@@ -1434,6 +1584,7 @@ void Emit(char * filename);
 Bool EmitInstr(Instr * code);
 Bool EmitInstrOp(InstrOp op, Var * result, Var * arg1, Var * arg2); 
 Bool EmitInstrInline(Instr * i);
+void EmitRuleCompile(Rule * rule);
 void EmitOpenBuffer(char * buf);
 void EmitCloseBuffer();
 void EmitChar(char c);
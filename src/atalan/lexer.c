@@ -365,6 +365,7 @@ void NextStringToken()
 	UInt16 n;
 	UInt8 c;
 
+	LEX.name = NULL;
 	n = 0;
 	do {
 		if (n >= 254) {
@@ -488,6 +489,7 @@ retry:
 	}
 */
 	*NAME = 0;
+	LEX.name = NULL;
 
 	if (c == '-' && LINE[LINE_POS] == '-' && LINE[LINE_POS+1] == '-') {
 		LINE_POS += 2;
@@ -514,15 +516,10 @@ retry:
 		LINE_POS--;
 
 		TOK = TOKEN_ID;
+		LEX.name = NameIntern(NAME);
 
-		if (c2 != L'\'' && !LEX.ignore_keywords) {
-			n = 0;
-			for(n = 0; n < KEYWORD_COUNT; n++) {
-				if (StrEqual(keywords[n], NAME)) {
-					TOK = TOKEN_KEYWORD + n;
-					break;
-				}
-			}
+		if (c2 != L'\'' && !LEX.ignore_keywords && LEX.name->canon->token != TOKEN_VOID) {
+			TOK = LEX.name->canon->token;
 		}
 
 	// $fdab  hex number
@@ -1033,8 +1030,14 @@ Purpose:
 
 void LexerInit()
 {
+	UInt16 n;
+
 	*FILE_DIR = 0;
 
+	for(n = 0; n < KEYWORD_COUNT; n++) {
+		NameIntern(keywords[n])->canon->token = TOKEN_KEYWORD + n;
+	}
+
 	BLK_TOP = 0;
 	BLK[BLK_TOP].end_token = TOKEN_VOID;
 	BLK[BLK_TOP].indent    = 0;
@@ -0,0 +1,135 @@
+/*
+LiveSet - Set of live variables
+
+(c) 2012 Rudolf Kudla 
+Licensed under the MIT license: http://www.opensource.org/licenses/mit-license.php
+
+Live set is a bit set of variables in some VarSet. Variable with set_index n is represented by bit n.
+Bits are packed in 64-bit words, so operations on whole sets process 64 variables at once.
+
+Unused bits in the last word are always 0, so whole words may be compared.
+
+*/
+
+#include "language.h"
+
+#define LIVE_WORD_MASK (LIVE_WORD_BITS - 1)
+
+LiveSet LiveSetAlloc(MemArena * arena, UInt32 count)
+/*
+Purpose:
+	Allocate empty live set for specified number of variables.
+	If the arena is NULL, set is allocated using MemAlloc and must be released using MemFree.
+*/
+{
+	UInt32 size = LiveSetWords(count) * sizeof(LiveWord);
+	if (size == 0) size = sizeof(LiveWord);
+	if (arena == NULL) return (LiveSet)MemAllocEmpty(size);
+	return (LiveSet)MemArenaAllocEmpty(arena, size);
+}
+
+void LiveSetMark(LiveSet set, UInt32 n, UInt8 mark)
+{
+	if (mark == VarLive) {
+		LiveSetInclude(set, n);
+	} else {
+		LiveSetExclude(set, n);
+	}
+}
+
+void LiveSetClear(LiveSet set, UInt32 count)
+{
+	MemEmpty(set, LiveSetWords(count) * sizeof(LiveWord));
+}
+
+void LiveSetFill(LiveSet set, UInt32 count)
+/*
+Purpose:
+	Mark all variables in the set as live.
+*/
+{
+	UInt32 i, words;
+	words = LiveSetWords(count);
+	for(i = 0; i < words; i++) set[i] = ~(LiveWord)0;
+	if ((count & LIVE_WORD_MASK) != 0) {
+		set[words-1] = ((LiveWord)1 << (count & LIVE_WORD_MASK)) - 1;
+	}
+}
+
+void LiveSetCopy(LiveSet dest, LiveSet src, UInt32 count)
+{
+	MemMove(dest, src, LiveSetWords(count) * sizeof(LiveWord));
+}
+
+void LiveSetUnion(LiveSet dest, LiveSet src, UInt32 count)
+{
+	UInt32 i, words;
+	words = LiveSetWords(count);
+	for(i = 0; i < words; i++) dest[i] |= src[i];
+}
+
+void LiveSetIntersect(LiveSet dest, LiveSet src, UInt32 count)
+{
+	UInt32 i, words;
+	words = LiveSetWords(count);
+	for(i = 0; i < words; i++) dest[i] &= src[i];
+}
+
+void LiveSetDifference(LiveSet dest, LiveSet src, UInt32 count)
+/*
+Purpose:
+	Remove variables in src from dest.
+*/
+{
+	UInt32 i, words;
+	words = LiveSetWords(count);
+	for(i = 0; i < words; i++) dest[i] &= ~src[i];
+}
+
+Bool LiveSetEqual(LiveSet l, LiveSet r, UInt32 count)
+{
+	return memcmp(l, r, LiveSetWords(count) * sizeof(LiveWord)) == 0;
+}
+
+static UInt32 LiveWordFirstBit(LiveWord w)
+/*
+Purpose:
+	Return index of lowest set bit in the (non zero) word.
+*/
+{
+#if defined(__GNUC__)
+	return (UInt32)__builtin_ctzll(w);
+#else
+	UInt32 n = 0;
+	if ((w & 0xffffffffULL) == 0) { n += 32; w >>= 32; }
+	if ((w & 0xffffULL) == 0) { n += 16; w >>= 16; }
+	if ((w & 0xffULL) == 0) { n += 8; w >>= 8; }
+	if ((w & 0xfULL) == 0) { n += 4; w >>= 4; }
+	if ((w & 0x3ULL) == 0) { n += 2; w >>= 2; }
+	if ((w & 0x1ULL) == 0) { n += 1; }
+	return n;
+#endif
+}
+
+UInt32 LiveSetNext(LiveSet set, UInt32 count, UInt32 n)
+/*
+Purpose:
+	Return index of first live variable with index n or higher.
+	Return count, if there is no such variable.
+*/
+{
+	UInt32 i, words;
+	LiveWord w;
+
+	if (n >= count) return count;
+
+	words = LiveSetWords(count);
+	i = n / LIVE_WORD_BITS;
+	w = set[i] & (~(LiveWord)0 << (n & LIVE_WORD_MASK));
+	while(w == 0) {
+		i++;
+		if (i >= words) return count;
+		w = set[i];
+	}
+	return i * LIVE_WORD_BITS + LiveWordFirstBit(w);
+}
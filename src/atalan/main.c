@@ -99,9 +99,11 @@ int main(int argc, char *argv[])
 	Int16 i;
 	Bool assembler = true;
 	Bool header = true;
+	Bool stats = false;
 	int result = 0;
 	char filename[MAX_PATH_LEN], log_filename[MAX_PATH_LEN];
 	char * s;
+	long byte_cost;
 	Bool header_out;
 	char * platform = NULL;
 	FILE * log_file = NULL;
@@ -143,6 +145,9 @@ int main(int argc, char *argv[])
 	InitErrors();
 
 	OPTIMIZE = 255;
+	OPTIMIZE_GOAL = GOAL_SPEED;
+	OPTIMIZE_BYTE_COST = 1;
+	PASS_ITERATIONS_MAX = 0;
 	ASSERTS_OFF = false;
 	*VERBOSE_PROC = 0;
 
@@ -158,10 +163,30 @@ int main(int argc, char *argv[])
 			VERBOSE = true;
 		} else if (StrEqual(argv[i], "-A")) {
 			assembler = false;
+		} else if (StrEqual(argv[i], "-STATS")) {
+			stats = true;
+		} else if (StrEqualPrefix(argv[i], "-PASSES=", 8)) {
+			if (!PassPipelineParse(argv[i] + 8)) exit(-1);
+		} else if (StrEqualPrefix(argv[i], "-ITERATIONS=", 12)) {
+			PASS_ITERATIONS_MAX = atoi(argv[i] + 12);
 		} else if (StrEqual(argv[i], "-R")) {
 			ASSERTS_OFF = true;
 		} else if (StrEqual(argv[i], "-O0")) {
 			OPTIMIZE = 0;
+		} else if (StrEqual(argv[i], "-Ot")) {
+			OPTIMIZE_GOAL = GOAL_SPEED;
+		} else if (StrEqual(argv[i], "-Os")) {
+			OPTIMIZE_GOAL = GOAL_SIZE;
+		} else if (StrEqual(argv[i], "-Ow")) {
+			i++;
+			byte_cost = 0;
+			if (i<argc) byte_cost = strtol(argv[i], &s, 10);
+			if (byte_cost <= 0 || byte_cost > 65535 || *s != 0) {
+				PrintFmt("-ow expects number of cycles one byte of code is worth (1..65535)\n");
+				exit(-1);
+			}
+			OPTIMIZE_GOAL = GOAL_WEIGHTED;
+			OPTIMIZE_BYTE_COST = (UInt16)byte_cost;
 		} else if (StrEqual(argv[i], "-O")) {
 			i++;
 			if (i<argc) {
@@ -203,7 +228,13 @@ int main(int argc, char *argv[])
 	"  -a Only generate assembler source code, but do not call assembler\n"
 	"  -p <name>  Platform to use\n"
 	"  -o <num>   Optimization level (0..9) 0 = no optimization\n"
+	"  -ot        Optimize for speed (default)\n"
+	"  -os        Optimize for size\n"
+	"  -ow <num>  Optimize for speed in loops and size elsewhere, one byte of code is worth <num> cycles\n"
 	"  -r Release version (do not generate asserts into resulting code)\n"
+	"  -stats     Print statistics of rule matching and optimization passes\n"
+	"  -passes=<list>      Comma separated optimization passes, (...) repeats group until no change\n"
+	"  -iterations=<num>   Maximal number of iterations of pass group (0 = unlimited)\n"
 	, argv[0]);
         exit(-1);
     }
@@ -230,6 +261,7 @@ int main(int argc, char *argv[])
 
 	//===== Initialize
 
+	NameInit();
 	TypeInit();
 	VarInit();
 	InstrInit();
@@ -331,6 +363,9 @@ int main(int argc, char *argv[])
 	//***** Analysis
 	ProcessUsedProc(GenerateBasicBlocks);
 	ProcessUsedProc(CheckValues);
+	if (OPTIMIZE > 0) {
+		ProcessUsedProc(OptimizeConstProp);
+	}
 
 	if (Verbose(NULL)) {
 		PrintHeader(1, "Infer Types");
@@ -381,12 +416,7 @@ int main(int argc, char *argv[])
 		if (Verbose(NULL)) {
 			PrintHeader(1, "Optimize");
 		}
-		ProcessUsedProc(OptimizeJumps);
-		ProcessUsedProc(ProcOptimize);
-		VarUse();
-		ProcessUsedProc(DeadCodeElimination);
-		ProcessUsedProc(OptimizeJumps);
-		ProcessUsedProc(OptimizeJumps);
+		PassPipelineRun();
 
 //		OptimizeLive(&ROOT_PROC);
 //		OptimizeVarMerge(&ROOT_PROC);
@@ -418,6 +448,13 @@ int main(int argc, char *argv[])
 
 	Emit(filename);
 
+	if (stats) {
+		RuleStatsPrint();
+		PassStatsPrint();
+	} else if (Verbose(NULL)) {
+		RuleCachePrintStats();
+	}
+
 	//==== Call the assembler
 	//     The command to call is defined using rule for INSTR_COMPILER.
 	//     Argument is filename (without extension) of the compiled file.
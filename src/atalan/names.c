@@ -6,7 +6,156 @@ Names declared in the source code are managed in the tree.
 (c) 2012 Rudolf Kudla 
 Licensed under the MIT license: http://www.opensource.org/licenses/mit-license.php
 
+All names used by variables are interned in the name table.
+Every spelling of a name is stored in the table only once and variables point to its text.
+
+Names are case insensitive, so 'Foo' and 'FOO' is the same name even if it has different spelling.
+All spellings of the name refer to one canonical name (the spelling used first).
+Two names are equal, if their canonical names are the same (see NameKey).
+We keep the spelling, so variables are printed in the form they were written.
+
 */
 
 #include "language.h"
+#include <ctype.h>
+
+#define NAME_HASH_INITIAL_SIZE 1024
+
+GLOBAL Name ** NAME_HASH;		// name table buckets
+GLOBAL UInt32 NAME_HASH_SIZE;	// number of buckets (always power of two)
+GLOBAL UInt32 NAME_COUNT;		// number of names in the table
+
+static UInt32 NameHash(char * str)
+/*
+Purpose:
+	Compute case insensitive hash of the name.
+*/
+{
+	UInt32 h = 5381;
+	while(*str != 0) {
+		h = h * 33 + (UInt8)tolower((UInt8)*str);
+		str++;
+	}
+	return h;
+}
+
+static void NameLink(Name * nm)
+{
+	Name ** p;
+	for(p = &NAME_HASH[nm->hash & (NAME_HASH_SIZE - 1)]; *p != NULL; p = &(*p)->next);
+	*p = nm;
+}
+
+static void NameHashResize(UInt32 size)
+{
+	Name ** old;
+	Name * nm, * next;
+	UInt32 old_size, i;
+
+	old = NAME_HASH;
+	old_size = NAME_HASH_SIZE;
+	NAME_HASH = (Name **)MemAllocEmpty(sizeof(Name *) * size);
+	NAME_HASH_SIZE = size;
+
+	// Names are appended to the end of the bucket, so canonical name is always found first
+
+	for(i = 0; i < old_size; i++) {
+		for(nm = old[i]; nm != NULL; nm = next) {
+			next = nm->next;
+			nm->next = NULL;
+			NameLink(nm);
+		}
+	}
+	if (old != NULL) MemFree(old);
+}
+
+static Name * NameAlloc(char * str, UInt32 h)
+{
+	Name * nm;
+	nm = (Name *)MemAllocEmpty(sizeof(Name) + StrLen(str));
+	strcpy(nm->text, str);
+	nm->hash  = h;
+	nm->canon = nm;
+	nm->token = TOKEN_VOID;
+	nm->op    = INSTR_NULL;
+	return nm;
+}
+
+Name * NameIntern(char * str)
+/*
+Purpose:
+	Find the name with exactly the same spelling in the name table.
+	If it does not exist yet, it is added.
+*/
+{
+	Name * nm, * canon;
+	UInt32 h;
+
+	h = NameHash(str);
+	canon = NULL;
+	for(nm = NAME_HASH[h & (NAME_HASH_SIZE - 1)]; nm != NULL; nm = nm->next) {
+		if (nm->hash == h && StrEqual(nm->text, str)) {
+			if (canon == NULL) canon = nm->canon;
+			if (strcmp(nm->text, str) == 0) return nm;
+		}
+	}
+
+	nm = NameAlloc(str, h);
+	if (canon != NULL) nm->canon = canon;
+	NameLink(nm);
+	NAME_COUNT++;
+	if (NAME_COUNT > NAME_HASH_SIZE) NameHashResize(NAME_HASH_SIZE * 2);
+	return nm;
+}
+
+char * NameAtom(char * str)
+/*
+Purpose:
+	Return interned text of the specified name.
+*/
+{
+	if (str == NULL) return NULL;
+	if (str == NAME && LEX.name != NULL) return LEX.name->text;
+	return NameIntern(str)->text;
+}
+
+char * NameFind(char * str)
+/*
+Purpose:
+	Return key of the specified name (see NameKey) or NULL, if there is no such name.
+	There can not be a variable with name, that has not been interned.
+*/
+{
+	Name * nm;
+	UInt32 h;
+
+	if (str == NULL) return NULL;
+
+	// Identifier read by lexer has already been interned
+	if (str == NAME && LEX.name != NULL) return LEX.name->canon->text;
+
+	h = NameHash(str);
+	for(nm = NAME_HASH[h & (NAME_HASH_SIZE - 1)]; nm != NULL; nm = nm->next) {
+		if (nm->hash == h && StrEqual(nm->text, str)) return nm->canon->text;
+	}
+	return NULL;
+}
+
+char * NameUnique(char * str)
+/*
+Purpose:
+	Create name, that is not stored in name table.
+	It is not equal to any other name, even if it has same text.
+	This is used for names of temporary variables.
+*/
+{
+	return NameAlloc(str, NameHash(str))->text;
+}
 
+void NameInit()
+{
+	NAME_HASH = NULL;
+	NAME_HASH_SIZE = 0;
+	NAME_COUNT = 0;
+	NameHashResize(NAME_HASH_INITIAL_SIZE);
+}
@@ -102,6 +102,7 @@ void LinkBlocks(Var * proc)
 	UInt32 n;
 
 repeat:
+	CFG_STAMP++;
 	for(blk = proc->instr, n=1; blk != NULL; blk = blk->next, n++) {
 		blk->to      = NULL;
 		blk->cond_to = NULL;
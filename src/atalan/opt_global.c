@@ -19,49 +19,340 @@ void MarkBlockAsUnprocessed(InstrBlock * block)
 	}
 }
 
-void DataFlowAnalysis(Var * proc, AnalyzeBlockFn block_fn, void * info)
+/*
+Data flow solver
+================
+
+Blocks are processed using worklist.
+Initially, all blocks are in the worklist in the order in which the information flows through the procedure
+(reverse postorder for forward analysis, postorder for backward analysis), so when a block is processed,
+the information from most of it's inputs has already been computed.
+Only blocks depending on a block whose information has changed are put to the worklist again
+(successors for forward analysis, predecessors for backward analysis).
+
+Successors of the block are to and cond_to. Predecessors are derived from them (they are the same as from and callers,
+but we do not rely on the caller lists being up to date).
+*/
+
+static UInt32 BlockSuccessors(InstrBlock * blk, InstrBlock ** succ)
 {
-	InstrBlock * blk;
-	Bool change;
+	UInt32 n = 0;
+	if (blk->to != NULL) succ[n++] = blk->to;
+	if (blk->cond_to != NULL && blk->cond_to != blk->to) succ[n++] = blk->cond_to;
+	return n;
+}
+
+static UInt32 BlockPostorder(Var * proc, InstrBlock ** order, UInt32 count)
+/*
+Purpose:
+	Fill the array with blocks of the procedure in postorder.
+	Blocks unreachable from the procedure entry follow the reachable ones, so every block of the procedure is in the array.
+	Return number of blocks reachable from the procedure entry.
+*/
+{
+	InstrBlock * blk, * b, * s, * succ[2];
+	InstrBlock ** stack;
+	UInt32 * next_succ;
+	UInt32 n, sp, reachable;
+
+	stack     = (InstrBlock **)MemAlloc(sizeof(InstrBlock *) * count);
+	next_succ = (UInt32 *)MemAlloc(sizeof(UInt32) * count);
 
-	change = true;
-	while (change) {
-		change = false;
-		for(blk = proc->instr; blk != NULL; blk = blk->next) {
-			change |= block_fn(proc, blk, info);
+	for(blk = proc->instr; blk != NULL; blk = blk->next) {
+		blk->processed = false;
+	}
+
+	n = 0; reachable = 0;
+	for(blk = proc->instr; blk != NULL; blk = blk->next) {
+		if (blk->processed) continue;
+		blk->processed = true;
+		stack[0] = blk; next_succ[0] = 0; sp = 1;
+		while(sp > 0) {
+			b = stack[sp-1];
+			if (next_succ[sp-1] < BlockSuccessors(b, succ)) {
+				s = succ[next_succ[sp-1]++];
+				if (!s->processed) {
+					s->processed = true;
+					stack[sp] = s; next_succ[sp] = 0; sp++;
+				}
+			} else {
+				sp--;
+				order[n++] = b;
+			}
 		}
+		if (blk == proc->instr) reachable = n;
 	}
-}
 
-#define Processed(blk, foll) (blk->foll == NULL || blk->foll->processed || blk->foll == blk)
+	MemFree(stack);
+	MemFree(next_succ);
+	return reachable;
+}
 
-void OptimizeDataFlowBack(Var * proc, AnalyzeBlockFn block_fn, void * info)
+void DataFlowAnalysis(Var * proc, DataFlowDirection dir, AnalyzeBlockFn block_fn, void * info)
 /*
 Purpose:
-	Perform analysis of whole procedure block by block.
-	Start from the end of the procedure and continue to the start of the procedure.
-	Only block, whose both possible followers were already processed are processed.
+	Perform data flow analysis of whole procedure.
+	Block function is called for blocks of the procedure until the information computed for blocks does not change.
+	Every block is processed at least once.
 */
 {
-	InstrBlock * blk;
-	Bool change;
+	InstrBlock * blk, * succ[2], ** order, * tmp;
+	UInt32 * dep_first, * deps, * queue;
+	Bool * queued;
+	UInt32 count, i, k, n, d, head, queue_count;
 
-	blk = proc->instr;
-	MarkBlockAsUnprocessed(blk);
-
-	change = true;
-	while(change) {
-		change = false;
-		for(blk = proc->instr; blk != NULL; blk = blk->next) {
-			if (!blk->processed) {
-				// Process block, if all it's followers have been processed (or if it has none).
-				if (Processed(blk, to) && Processed(blk, cond_to)) {	//(blk->to == NULL || blk->to->processed) && (blk->cond_to == NULL || blk->cond_to->processed || blk->cond_to == blk)) {
-					block_fn(proc, blk, info);
-					blk->processed = true;
-					change = true;
+	count = 0;
+	for(blk = proc->instr; blk != NULL; blk = blk->next) count++;
+	if (count == 0) return;
+
+	order = (InstrBlock **)MemAlloc(sizeof(InstrBlock *) * count);
+	BlockPostorder(proc, order, count);
+
+	if (dir == DATAFLOW_FORWARD) {
+		for(i = 0; i < count / 2; i++) {
+			tmp = order[i]; order[i] = order[count - 1 - i]; order[count - 1 - i] = tmp;
+		}
+	}
+
+	for(i = 0; i < count; i++) {
+		order[i]->order = i;
+	}
+
+	// Build lists of blocks, that must be processed again when the information for the block changes.
+	// Every block has at most two successors, so there is at most 2 * count dependencies.
+
+	dep_first = (UInt32 *)MemAllocEmpty(sizeof(UInt32) * (count + 1));
+	deps      = (UInt32 *)MemAlloc(sizeof(UInt32) * 2 * count);
+
+	for(i = 0; i < count; i++) {
+		n = BlockSuccessors(order[i], succ);
+		for(k = 0; k < n; k++) {
+			d = (dir == DATAFLOW_FORWARD) ? i : succ[k]->order;
+			dep_first[d + 1]++;
+		}
+	}
+	for(i = 0; i < count; i++) {
+		dep_first[i + 1] += dep_first[i];
+	}
+	queue = (UInt32 *)MemAlloc(sizeof(UInt32) * count);		// used as fill position for each block
+	for(i = 0; i < count; i++) queue[i] = dep_first[i];
+	for(i = 0; i < count; i++) {
+		n = BlockSuccessors(order[i], succ);
+		for(k = 0; k < n; k++) {
+			if (dir == DATAFLOW_FORWARD) {
+				deps[queue[i]++] = succ[k]->order;
+			} else {
+				d = succ[k]->order;
+				deps[queue[d]++] = i;
+			}
+		}
+	}
+
+	// Worklist is circular queue, every block is in the queue at most once
+
+	queued = (Bool *)MemAlloc(sizeof(Bool) * count);
+	for(i = 0; i < count; i++) {
+		queue[i] = i;
+		queued[i] = true;
+	}
+	head = 0;
+	queue_count = count;
+
+	while(queue_count > 0) {
+		i = queue[head];
+		head = (head + 1) % count;
+		queue_count--;
+		queued[i] = false;
+
+		if (block_fn(proc, order[i], info)) {
+			for(k = dep_first[i]; k < dep_first[i + 1]; k++) {
+				d = deps[k];
+				if (!queued[d]) {
+					queued[d] = true;
+					queue[(head + queue_count) % count] = d;
+					queue_count++;
 				}
 			}
 		}
 	}
+
+	MemFree(queued);
+	MemFree(queue);
+	MemFree(deps);
+	MemFree(dep_first);
+	MemFree(order);
+}
+
+/*
+Dominators and loops
+====================
+
+Block D dominates block B, if every path from the procedure entry to B goes through D.
+Immediate dominators are computed using the algorithm by Cooper, Harvey and Kennedy (A Simple, Fast Dominance Algorithm).
+It iterates over the blocks in reverse postorder and intersects dominators of block predecessors
+until nothing changes (usually two iterations are enough).
+
+Jump from block B to block H, which dominates B, is a back edge. It closes natural loop with header H.
+Blocks, from which B can be reached without going through H, form the body of the loop.
+Loops are found from the innermost ones (headers are processed in postorder), so when we find block, which is
+already in some loop, the whole inner loop is added to the current loop.
+*/
+
+static InstrBlock * DomIntersect(InstrBlock * a, InstrBlock * b)
+{
+	// Dominators have higher postorder number than the blocks they dominate.
+	while(a != b) {
+		while(a->order < b->order) a = a->idom;
+		while(b->order < a->order) b = b->idom;
+	}
+	return a;
+}
+
+Bool BlockDominates(InstrBlock * dom, InstrBlock * blk)
+/*
+Purpose:
+	Return true, if every path from procedure entry to the block goes through the dom block.
+	Dominator tree must be computed by LoopForest.
+*/
+{
+	for(; blk != NULL; blk = blk->idom) {
+		if (blk == dom) return true;
+	}
+	return false;
+}
+
+static InstrBlock * LoopOutermost(InstrBlock * header)
+{
+	while(header->loop_parent != NULL) header = header->loop_parent;
+	return header;
 }
 
+void LoopForest(Var * proc)
+/*
+Purpose:
+	Compute dominator tree and loop nesting forest of the procedure.
+	Set idom, loop_header, loop_parent, loop_end and loop_depth of every block.
+	Blocks must be numbered (seq_no).
+*/
+{
+	InstrBlock * blk, * b, * h, * p, * end, * new_idom, * succ[2], ** order, ** preds, ** stack;
+	UInt32 * pred_first, * fill;
+	UInt32 count, reachable, n, k, sc, sp;
+	Bool changed, * broken;
+
+	count = 0;
+	for(blk = proc->instr; blk != NULL; blk = blk->next) {
+		blk->idom        = NULL;
+		blk->loop_header = NULL;
+		blk->loop_parent = NULL;
+		blk->loop_end    = NULL;
+		blk->loop_depth  = 0;
+		count++;
+	}
+	if (count == 0) return;
+
+	order = (InstrBlock **)MemAlloc(sizeof(InstrBlock *) * count);
+	reachable = BlockPostorder(proc, order, count);
+	for(n = 0; n < count; n++) order[n]->order = n;
+
+	// Predecessors of reachable blocks (unreachable predecessors are ignored)
+
+	pred_first = (UInt32 *)MemAllocEmpty(sizeof(UInt32) * (count + 1));
+	fill       = (UInt32 *)MemAlloc(sizeof(UInt32) * count);
+	preds      = (InstrBlock **)MemAlloc(sizeof(InstrBlock *) * 2 * count);
+	stack      = (InstrBlock **)MemAlloc(sizeof(InstrBlock *) * 2 * count);
+	broken     = (Bool *)MemAllocEmpty(sizeof(Bool) * count);
+
+	for(n = 0; n < reachable; n++) {
+		sc = BlockSuccessors(order[n], succ);
+		for(k = 0; k < sc; k++) pred_first[succ[k]->order + 1]++;
+	}
+	for(n = 0; n < count; n++) {
+		pred_first[n + 1] += pred_first[n];
+		fill[n] = pred_first[n];
+	}
+	for(n = 0; n < reachable; n++) {
+		sc = BlockSuccessors(order[n], succ);
+		for(k = 0; k < sc; k++) preds[fill[succ[k]->order]++] = order[n];
+	}
+
+	//=== Dominators
+
+	blk = proc->instr;
+	blk->idom = blk;
+	do {
+		changed = false;
+		// Reverse postorder, except the entry block (which is the last one)
+		for(n = reachable - 1; n-- > 0; ) {
+			b = order[n];
+			new_idom = NULL;
+			for(k = pred_first[n]; k < pred_first[n + 1]; k++) {
+				p = preds[k];
+				if (p->idom == NULL) continue;
+				new_idom = (new_idom == NULL) ? p : DomIntersect(p, new_idom);
+			}
+			if (b->idom != new_idom) {
+				b->idom = new_idom;
+				changed = true;
+			}
+		}
+	} while(changed);
+	blk->idom = NULL;
+
+	//=== Loops
+
+	for(n = 0; n < reachable; n++) {
+		h = order[n];
+		sp = 0;
+		for(k = pred_first[n]; k < pred_first[n + 1]; k++) {
+			p = preds[k];
+			if (BlockDominates(h, p)) stack[sp++] = p;
+		}
+		if (sp == 0) continue;
+
+		h->loop_header = h;
+		end = h;
+		while(sp > 0) {
+			b = stack[--sp];
+			if (b->loop_header == NULL) {
+				b->loop_header = h;
+				if (b->seq_no > end->seq_no) end = b;
+			} else {
+				// Block is already in the loop (or in the inner loop, which we now add to this loop)
+				b = LoopOutermost(b->loop_header);
+				if (b == h) continue;
+				b->loop_parent = h;
+				if (b->loop_end->seq_no > end->seq_no) end = b->loop_end;
+			}
+			for(k = pred_first[b->order]; k < pred_first[b->order + 1]; k++) stack[sp++] = preds[k];
+		}
+		h->loop_end = end;
+	}
+
+	// Loop depth of every block and check, that the loop is continuous sequence of blocks
+
+	for(n = 0; n < reachable; n++) {
+		b = order[n];
+		for(h = b->loop_header; h != NULL; h = h->loop_parent) {
+			b->loop_depth++;
+			if (b->seq_no < h->seq_no) broken[h->order] = true;
+		}
+	}
+
+	for(n = 0; n < reachable; n++) {
+		h = order[n];
+		end = h->loop_end;
+		if (end != NULL) {
+			if (broken[n] || (end->to != h && end->cond_to != h)) {
+				h->loop_end = NULL;
+			}
+		}
+	}
+
+	MemFree(broken);
+	MemFree(stack);
+	MemFree(preds);
+	MemFree(fill);
+	MemFree(pred_first);
+	MemFree(order);
+}
@@ -139,6 +139,60 @@ Purpose:
 	return false;
 }
 
+static Bool ResultReadsVar(Var * result, Var * var)
+/*
+Purpose:
+	Test, whether writing the result reads the variable (as array index or pointer).
+*/
+{
+	if (result == NULL) return false;
+	switch(result->mode) {
+	case INSTR_DEREF:
+		return VarUsesVar(result->var, var);
+	case INSTR_ELEMENT:
+	case INSTR_BYTE:
+	case INSTR_BIT:
+		return ResultReadsVar(result->adr, var) || VarUsesVar(result->var, var);
+	default:
+		return false;
+	}
+}
+
+static Bool ProcUsesVar(Var * proc, Var * var)
+/*
+Purpose:
+	Test, whether the procedure or procedures called by it may read the variable.
+	Registers are passed to procedure only as arguments, so they are not tested here.
+	Procedures called using address and procedures without instructions use only their arguments.
+*/
+{
+	Bool uses = false;
+	Instr * i;
+	InstrBlock * blk;
+
+	if (proc->type->variant != TYPE_PROC || VarIsReg(var)) return false;
+
+	if (FlagOff(proc->flags, VarProcessed)) {
+		SetFlagOn(proc->flags, VarProcessed);
+		for(blk = proc->instr; blk != NULL; blk = blk->next) {
+			for(i = blk->first; i != NULL; i = i->next) {
+				if (i->op == INSTR_LINE) continue;
+				if (i->op == INSTR_CALL) {
+					uses = ProcUsesVar(i->result, var);
+				} else {
+					uses = VarUsesVar(i->arg1, var) || VarMayUseVar(i->arg1, var) || VarUsesVar(i->arg2, var) || VarMayUseVar(i->arg2, var);
+					// jump instructions do have result, but it is label we jump to
+					if (!uses && !IS_INSTR_JUMP(i->op)) uses = ResultReadsVar(i->result, var);
+				}
+				if (uses) goto done;
+			}
+		}
+done:
+		SetFlagOff(proc->flags, VarProcessed);
+	}
+	return uses;
+}
+
 UInt8 VarIsLiveInBlock(Var * proc, InstrBlock * block, Var * var)
 /*
 Purpose:
@@ -163,7 +217,7 @@ Purpose:
 		if (i->op == INSTR_LINE) continue;
 
 		if (i->op == INSTR_CALL || i->op == INSTR_GOTO) {
-			if (VarUsesVar(i->result, var)) { res1 = 1; goto done; }
+			if (VarUsesVar(i->result, var) || ProcUsesVar(i->result, var)) { res1 = 1; goto done; }
 		}
 
 		if (var->mode == INSTR_ELEMENT || var->mode == INSTR_BYTE) {
@@ -211,11 +265,99 @@ done:
 	return res1;
 }
 
+static void VarMarkUsedLive(Var * var)
+/*
+Purpose:
+	Mark variables read by the argument of instruction in called procedure as live.
+	Registers are set by the procedure itself or passed as arguments, so they are not marked.
+*/
+{
+	if (var == NULL) return;
+	switch(var->mode) {
+	case INSTR_VAR:
+		if (!VarIsReg(var)) VarMarkLive(var);
+		break;
+	case INSTR_DEREF:
+		VarMarkUsedLive(var->var);
+		break;
+	case INSTR_ELEMENT:
+	case INSTR_BYTE:
+	case INSTR_BIT:
+		// Element with variable index may be any element of the array, so whole array is marked
+		VarMarkUsedLive(var->adr);
+		VarMarkUsedLive(var->var);
+		break;
+	case INSTR_INT:
+	case INSTR_TEXT:
+	case INSTR_CONST:
+	case INSTR_TYPE:
+	case INSTR_SCOPE:
+	case INSTR_SRC_FILE:
+		break;
+	default:
+		// tuples, ranges and operator expressions
+		VarMarkUsedLive(var->adr);
+		VarMarkUsedLive(var->var);
+		break;
+	}
+}
+
+static void VarMarkResultUsedLive(Var * var)
+/*
+Purpose:
+	Mark variables read when writing the result of instruction in called procedure as live (see ResultReadsVar).
+*/
+{
+	if (var == NULL) return;
+	switch(var->mode) {
+	case INSTR_DEREF:
+		VarMarkUsedLive(var->var);
+		break;
+	case INSTR_ELEMENT:
+	case INSTR_BYTE:
+	case INSTR_BIT:
+		VarMarkResultUsedLive(var->adr);
+		VarMarkUsedLive(var->var);
+		break;
+	}
+}
+
+static void ProcMarkUsedLive(Var * proc)
+/*
+Purpose:
+	Mark all variables, that may be read by the procedure or procedures called by it, as live (see ProcUsesVar).
+*/
+{
+	Instr * i;
+	InstrBlock * blk;
+
+	if (proc->type->variant != TYPE_PROC) return;
+
+	if (FlagOff(proc->flags, VarProcessed)) {
+		SetFlagOn(proc->flags, VarProcessed);
+		for(blk = proc->instr; blk != NULL; blk = blk->next) {
+			for(i = blk->first; i != NULL; i = i->next) {
+				if (i->op == INSTR_LINE) continue;
+				if (i->op == INSTR_CALL) {
+					ProcMarkUsedLive(i->result);
+				} else {
+					VarMarkUsedLive(i->arg1);
+					VarMarkUsedLive(i->arg2);
+					if (!IS_INSTR_JUMP(i->op)) VarMarkResultUsedLive(i->result);
+				}
+			}
+		}
+		SetFlagOff(proc->flags, VarProcessed);
+	}
+}
+
 void MarkProcLive(Var * proc)
 {
-	//TODO: We should actually step through the code, as procedure may access and modify global variables
 	Var * var;
 
+	// Procedure may read global variables
+	ProcMarkUsedLive(proc);
+
 	FOR_EACH_LOCAL(proc, var)
 		if (FlagOff(var->submode, SUBMODE_ARG_IN | SUBMODE_ARG_OUT)) {
 			VarMarkDead(var);
@@ -337,6 +479,8 @@ Bool OptimizeLive(Var * proc)
 		PrintProc(proc);
 	}
 
+	MarkDirtyBlocks(proc, true);
+
 	for(blk = proc->instr; blk != NULL; blk = blk->next) {
 		
 		// Compute total number of instructions in procedure, so we can report position of removed instruction
@@ -347,6 +491,8 @@ Bool OptimizeLive(Var * proc)
 			n += blk_n;
 		}
 
+		if (!blk->dirty) continue;
+
 		// At the beginning, all variables are dead (except procedure output variables for tail blocks)
 
 		FOR_EACH_VAR(var)
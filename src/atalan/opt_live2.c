@@ -7,20 +7,38 @@ Licensed under the MIT license: http://www.opensource.org/licenses/mit-license.p
 
 See: http://en.wikipedia.org/wiki/Liveness_analysis
 
+Liveness computed for whole procedure is used to remove stores, whose result (including processor flags) is dead on every path.
+
 
 
 */
 
 #include "language.h"
+
+extern Var ROOT_PROC;
+
 // Global information used by analysis
 
+typedef struct LiveProcTag LiveProc;
+
+struct LiveProcTag {
+	LiveProc * next;
+	Var * proc;
+	LiveSet used;				// variables possibly used by the procedure
+};
 
 typedef struct
 {
 	VarSet vars;				// variables somehow used in the procedure
-
+	UInt32 count;				// number of variables in the set
+	LiveSet exit;				// variables live at the end of procedure
+	LiveSet call;				// variables live when other procedure is called
+	LiveSet tmp;				// work set used when analyzing block
+	LiveProc * procs;			// variables used by called procedures
+	MemArena arena;				// all live sets are allocated from this arena
 } LiveInfo;
 
+GLOBAL LiveInfo LIVE;
 
 static Bool FilterVar(Var * var)
 /*
@@ -34,45 +52,71 @@ static void VarAddReference(Var * var, VarSet * set)
 {
 	if (var == NULL) return;
 
-	if (VarIsConst(var) || VarIsLabel(var) || var->type->variant == TYPE_PROC || var->type->variant == TYPE_MACRO) return;
+	if (!FilterVar(var)) return;
 
-	if (var->mode == INSTR_VAR) {
+	switch(var->mode) {
+	case INSTR_VAR:
 		VarSetAdd(set, var, NULL);
 
-	// Array references with constant index are handled like simple variable
-	} else if ((var->mode == INSTR_BYTE || var->mode == INSTR_ELEMENT) && VarIsConst(var->var)) {
-		VarSetAdd(set, var, NULL);		
-		VarSetAdd(set, var->adr, NULL);
-	} else {
+		// Alias of other variable (or tuple of variables, like processor flags)
+		if (var->adr != NULL && !VarIsConst(var->adr)) {
+			VarAddReference(var->adr, set);
+		}
+		break;
+
+	case INSTR_ELEMENT:
+	case INSTR_BYTE:
+	case INSTR_BIT:
+		// Array references with constant index are handled like simple variable
+		if (var->mode != INSTR_BIT && VarIsConst(var->var)) {
+			VarSetAdd(set, var, NULL);
+		}
 		VarAddReference(var->adr, set);
 		VarAddReference(var->var, set);
-	}
+		break;
 
+	// Dereference does not use adr, pointer is stored in var
+	case INSTR_DEREF:
+		VarAddReference(var->var, set);
+		break;
+
+	// Constants, types and scopes do not reference any variable
+	case INSTR_INT:
+	case INSTR_TEXT:
+	case INSTR_CONST:
+	case INSTR_TYPE:
+	case INSTR_SCOPE:
+	case INSTR_SRC_FILE:
+		break;
+
+	// Tuple, range, variant and operations (like x-1) reference both operands
+	default:
+		VarAddReference(var->adr, set);
+		VarAddReference(var->var, set);
+		break;
+	}
 }
 
-void ProcAddReferencedVars(Var * proc, VarSet * set);
-
 static Bool InstrAddReferencedVars(Loc * loc, void * data)
 {
 	VarSet * set = (VarSet *)data;
 	Instr * i = loc->i;
 	InstrInfo * ii = &INSTR_INFO[i->op];
 
-	if (i->op == INSTR_CALL) {
-		ProcAddReferencedVars(i->result, set);
-	} else {
+	// Variables used by called procedure are handled by the call live set (see LiveVariableAnalysis)
+	if (i->op == INSTR_CALL || i->op == INSTR_LINE) return false;
 
-		if (ii->arg_type[0] != TYPE_VOID) {
-			VarAddReference(i->result, set);
-		}
+	if (ii->arg_type[0] != TYPE_VOID) {
+		VarAddReference(i->result, set);
+		if (i->rule != NULL) VarAddReference(i->rule->flags, set);
+	}
 
-		if (ii->arg_type[1] != TYPE_VOID) {
-			VarAddReference(i->arg1, set);
-		}
+	if (ii->arg_type[1] != TYPE_VOID) {
+		VarAddReference(i->arg1, set);
+	}
 
-		if (ii->arg_type[2] != TYPE_VOID) {
-			VarAddReference(i->arg2, set);
-		}
+	if (ii->arg_type[2] != TYPE_VOID) {
+		VarAddReference(i->arg2, set);
 	}
 
 	return false;
@@ -93,167 +137,475 @@ void ProcReferencedVars(Var * proc, VarSet * set)
 	ProcAddReferencedVars(proc, set);
 }
 
-void VarSetLiveness(LiveSet live, VarSet * vars, Var * var, int mark)
+static Bool VarInSet(Var * var, UInt32 * p_idx)
 {
-	UInt16 idx;
+	UInt32 idx = var->set_index;
+	if (idx < LIVE.count && VarSetItem(&LIVE.vars, idx)->key == var) {
+		*p_idx = idx;
+		return true;
+	}
+	return false;
+}
+
+void VarSetLiveness(LiveSet live, Var * var, UInt8 mark)
+/*
+Purpose:
+	Mark the variable in live set as live (read) or dead (written).
+	Variables used to compute the address of variable (array indexes, pointers) are always marked live.
+*/
+{
+	UInt32 idx;
+
 	if (var == NULL) return;
 
-	idx = var->set_index;
-	if (idx >= 0 && idx < VarSetCount(vars) && VarSetItem(vars, idx)->key == var) {
-		live[idx] = mark;
+	if (VarInSet(var, &idx)) {
+		LiveSetMark(live, idx, mark);
 	}
 
-	if (var->mode == INSTR_VAR) {
+	switch(var->mode) {
+	case INSTR_VAR:
+		// Reading alias reads the aliased variable too.
+		// Writing the alias kills the other variable only if it overwrites it whole (tuple of registers for example).
 		if (var->adr != NULL) {
-			VarSetLiveness(live, vars, var->adr, mark);
+			if (mark == VarLive || var->adr->mode == INSTR_TUPLE || (var->adr->mode == INSTR_VAR && VarByteSize(var->adr) == VarByteSize(var))) {
+				VarSetLiveness(live, var->adr, mark);
+			}
+		}
+		break;
+
+	case INSTR_TUPLE:
+		VarSetLiveness(live, var->adr, mark);
+		VarSetLiveness(live, var->var, mark);
+		break;
+
+	// For array element, we mark the index variable as read.
+	// Writing the element does not kill the rest of the array.
+	case INSTR_ELEMENT:
+	case INSTR_BYTE:
+	case INSTR_BIT:
+		if (mark == VarLive || var->adr->mode != INSTR_VAR) {
+			VarSetLiveness(live, var->adr, VarLive);
 		}
+		VarSetLiveness(live, var->var, VarLive);
+		break;
+
+	// Dereference keeps the pointer in var (adr is not used).
+	// Pointer is read both when reading and writing using it, and the store kills nothing.
+	case INSTR_DEREF:
+		VarSetLiveness(live, var->var, VarLive);
+		break;
+
+	// Constants, types and scopes do not reference any variable
+	case INSTR_INT:
+	case INSTR_TEXT:
+	case INSTR_CONST:
+	case INSTR_TYPE:
+	case INSTR_SCOPE:
+	case INSTR_SRC_FILE:
+		break;
+
+	// Both bounds of range, both values of variant and both operands of operation (like x-1 used as index) are read
+	default:
+		VarSetLiveness(live, var->adr, VarLive);
+		VarSetLiveness(live, var->var, VarLive);
+		break;
+	}
+}
 
-	} else if (var->mode == INSTR_TUPLE) {
-		VarSetLiveness(live, vars, var->adr, mark);
-		VarSetLiveness(live, vars, var->var, mark);
+static Var * VarRoot(Var * var)
+/*
+Purpose:
+	Return variable, whose part is accessed by specified array element, byte or bit.
+*/
+{
+	while(var != NULL && (var->mode == INSTR_ELEMENT || var->mode == INSTR_BYTE || var->mode == INSTR_BIT)) {
+		var = var->adr;
+	}
+	return var;
+}
 
-	// For array element, we mark the index variable as read, while whole array gets marked as dead/alive
-	} else if (var->mode == INSTR_ELEMENT || var->mode == INSTR_BYTE || var->mode == INSTR_BIT) {
-		VarSetLiveness(live, vars, var->adr, mark);
-		VarSetLiveness(live, vars, var->var, VarLive);
+static Bool VarIsExposed(Var * var, LiveSet exposed)
+/*
+Purpose:
+	Test, whether address of the variable has been taken.
+*/
+{
+	UInt32 idx;
+	var = VarRoot(var);
+	return var != NULL && VarInSet(var, &idx) && LiveSetTest(exposed, idx);
+}
 
-	} else {
-		VarSetLiveness(live, vars, var->adr, VarLive);
-		VarSetLiveness(live, vars, var->var, VarLive);
-	}
+static Bool VarIsPrivate(Var * proc, Var * var, LiveSet exposed)
+/*
+Purpose:
+	Return true, if the variable may be accessed only by the code of the procedure.
+	Variables of root procedure are global, arguments are used by callers and variables 
+	with address taken may be accessed using pointer in other procedures.
+*/
+{
+	if (proc == &ROOT_PROC) return false;
+	var = VarRoot(var);
+	if (var == NULL || var->mode != INSTR_VAR) return false;
+	if (var->scope != proc || VarIsArg(var)) return false;
+	return !VarIsExposed(var, exposed);
+}
 
+static Bool InstrIsCall(Instr * i)
+{
+	return i->op == INSTR_CALL || (i->op == INSTR_GOTO && i->result->type->variant == TYPE_PROC);
 }
 
-Bool AnalyzeLiveBlock(Var * proc, InstrBlock * blk, void * pinfo)
+static void ProcUsedVars(Var * proc, LiveSet used)
 /*
 Purpose:
-	Perform variable live/dead analysis on specified block.
+	Mark variables, that may be used by the procedure or procedures called by it, as live.
+	Variables written by the procedure are marked too, as we do not know, whether they are read before written.
 */
 {
-	InstrInfo * ii;
+	InstrBlock * blk;
 	Instr * i;
-	LiveSet set;
-	LiveInfo * info = (LiveInfo*)pinfo;
-	UInt16 count, n;
+	InstrInfo * ii;
 	Var * var;
-	LiveSet lset, rset;
-	Bool changed = false;
 
-	count = VarSetCount(&info->vars);
+	// We do not know, which procedure is called using address, so it is handled like procedure without instructions.
+	// Such procedure may use any non-private variable and it's input arguments (passed in registers).
 
-	set = (LiveSet)MemAlloc(count);
+	if (proc->type->variant == TYPE_ADR) {
+		proc = proc->type->element->owner;
+	}
 
-	// Compute block out
-	
-	if (blk->to == NULL && blk->cond_to == NULL) {
+	if (proc->type->variant != TYPE_PROC || proc->instr == NULL) {
+		LiveSetUnion(used, LIVE.call, LIVE.count);
+		FOR_EACH_IN_ARG(proc, var)
+			VarSetLiveness(used, var, VarLive);
+		NEXT_LOCAL
+		return;
+	}
 
-		for (n=0; n<count; n++) set[n] = VarDead;
+	if (FlagOn(proc->flags, VarProcessed)) return;
+	SetFlagOn(proc->flags, VarProcessed);
 
-		// For exit block, mark output variables and non-local variables as live
-		if (blk->to == NULL && blk->cond_to == NULL) {
-			for (n=0; n<count; n++) {
-				var = VarSetItem(&info->vars, n)->key;
-				if (VarIsOutArg(var) || !VarIsLocal(proc, var)) {
-					set[n] = VarLive;
-				}
+	for(blk = proc->instr; blk != NULL; blk = blk->next) {
+		for(i = blk->first; i != NULL; i = i->next) {
+			if (i->op == INSTR_LINE) continue;
+			if (InstrIsCall(i)) {
+				ProcUsedVars(i->result, used);
+				continue;
+			}
+
+			if (VarDereferences(i->arg1) || VarDereferences(i->arg2)) {
+				LiveSetUnion(used, LIVE.call, LIVE.count);
+			}
+
+			ii = &INSTR_INFO[i->op];
+			if (ii->arg_type[0] != TYPE_VOID) {
+				VarSetLiveness(used, i->result, VarLive);
+				if (i->rule != NULL) VarSetLiveness(used, i->rule->flags, VarLive);
 			}
+			if (ii->arg_type[1] != TYPE_VOID) VarSetLiveness(used, i->arg1, VarLive);
+			if (ii->arg_type[2] != TYPE_VOID) VarSetLiveness(used, i->arg2, VarLive);
 		}
+	}
 
-	// Merge the two sets
-	// Variable is dead, if it is dead in both branches
+	FOR_EACH_IN_ARG(proc, var)
+		VarSetLiveness(used, var, VarLive);
+	NEXT_LOCAL
 
-	} else {
-		lset = (blk->to != NULL)?(LiveSet)blk->to->analysis_data:NULL;
-		rset = (blk->cond_to != NULL)?(LiveSet)blk->cond_to->analysis_data:NULL;
+	SetFlagOff(proc->flags, VarProcessed);
+}
 
-		if (lset == NULL) lset = rset;
-		if (rset == NULL) rset = lset;
+static LiveSet CallUsedVars(Var * proc)
+/*
+Purpose:
+	Return set of variables, that may be used by called procedure.
+	The set is computed only once for every called procedure.
+*/
+{
+	LiveProc * lp;
 
-		for(n=0; n<count; n++) {
-			if (lset[n] == VarDead && rset[n] == VarDead) {
-				set[n] = VarDead;
-			} else {
-				set[n] = VarLive;
-			}
-		}
+	for(lp = LIVE.procs; lp != NULL; lp = lp->next) {
+		if (lp->proc == proc) return lp->used;
 	}
 
-	// Traverse block backwards and mark variables as live/dead
+	lp = MemArenaAllocStruct(&LIVE.arena, LiveProc);
+	lp->proc = proc;
+	lp->used = LiveSetAlloc(&LIVE.arena, LIVE.count);
+	ProcUsedVars(proc, lp->used);
+	lp->next = LIVE.procs;
+	LIVE.procs = lp;
+	return lp->used;
+}
 
-	for(i = blk->last; i != NULL; i = i->prev) {
-		ii = &INSTR_INFO[i->op];
+static void InstrLiveness(Var * proc, Instr * i, LiveSet set)
+/*
+Purpose:
+	Update the live set so it describes the variables live before the instruction (live set describes state after the instruction).
+*/
+{
+	InstrInfo * ii = &INSTR_INFO[i->op];
 
-		if (i->op == INSTR_CALL) {
-			// mark all variables used by the procedure as live
-//			VarAllocProc(info, i->result, live);
-		} else {
+	if (i->op == INSTR_LINE) return;
 
-			if (ii->arg_type[0] != TYPE_VOID) {
-				VarSetLiveness(set, &info->vars, i->result, VarDead);
-				VarSetLiveness(set, &info->vars, i->rule->flags, VarDead);		// set flags as dead
-			}
+	if (i->op == INSTR_RETURN) {
+		LiveSetCopy(set, LIVE.exit, LIVE.count);
+		return;
+	}
 
-			if (ii->arg_type[1] != TYPE_VOID) {
-				VarSetLiveness(set, &info->vars, i->arg1, VarLive);
-			}
+	// Variables used by called procedure are live
+	if (InstrIsCall(i)) {
+		LiveSetUnion(set, CallUsedVars(i->result), LIVE.count);
+		return;
+	}
 
-			if (ii->arg_type[2] != TYPE_VOID) {
-				VarSetLiveness(set, &info->vars, i->arg2, VarLive);
-			}
-		}
+	// Result must be marked dead first, to properly handle instructions like x = x + 1
+
+	if (ii->arg_type[0] != TYPE_VOID) {
+		VarSetLiveness(set, i->result, VarDead);
+		if (i->rule != NULL) VarSetLiveness(set, i->rule->flags, VarDead);		// set flags as dead
 	}
 
-	// Test, if set has changed
-	for(n = 0; n < count && !changed; n++) {
-		if (set[n] != ((LiveSet)blk->analysis_data)[n]) changed = true;
+	// Reading using pointer may read any variable, whose address has been taken
+
+	if (VarDereferences(i->arg1) || VarDereferences(i->arg2)) {
+		LiveSetUnion(set, LIVE.call, LIVE.count);
 	}
 
-	MemFree(blk->analysis_data);
-	blk->analysis_data = set;
+	if (ii->arg_type[1] != TYPE_VOID) {
+		VarSetLiveness(set, i->arg1, VarLive);
+	}
 
-	return changed;
+	if (ii->arg_type[2] != TYPE_VOID) {
+		VarSetLiveness(set, i->arg2, VarLive);
+	}
 }
 
+static void BlockLiveOut(InstrBlock * blk, LiveSet set)
 /*
+Purpose:
+	Compute set of variables live at the end of the block.
+	Variable is dead, if it is dead in all following blocks.
+*/
+{
+	if (blk->to == NULL && blk->cond_to == NULL) {
+		LiveSetCopy(set, LIVE.exit, LIVE.count);
+	} else {
+		LiveSetClear(set, LIVE.count);
+		if (blk->to != NULL) LiveSetUnion(set, (LiveSet)blk->to->analysis_data, LIVE.count);
+		if (blk->cond_to != NULL) LiveSetUnion(set, (LiveSet)blk->cond_to->analysis_data, LIVE.count);
+	}
+}
 
-If variable is dead in all following blocks, it is dead. Otherwise it is supposed to be live.
-
+Bool AnalyzeLiveBlock(Var * proc, InstrBlock * blk, void * pinfo)
+/*
+Purpose:
+	Perform variable live/dead analysis on specified block.
+	Set of variables live at the beginning of the block is stored in block analysis data.
 */
+{
+	Instr * i;
+	LiveSet set = LIVE.tmp;
 
-void LiveVariableAnalysis(Var * proc)
+	BlockLiveOut(blk, set);
+
+	// Traverse block backwards and mark variables as live/dead
+
+	for(i = blk->last; i != NULL; i = i->prev) {
+		InstrLiveness(proc, i, set);
+	}
+
+	// Test, if set has changed
+
+	if (LiveSetEqual(set, (LiveSet)blk->analysis_data, LIVE.count)) return false;
+	LiveSetCopy((LiveSet)blk->analysis_data, set, LIVE.count);
+	return true;
+}
+
+static Bool InstrMarkExposed(Loc * loc, void * data)
 {
-	// initialize all last blocks (there is typically one) with return and global values
+	LiveSet exposed = (LiveSet)data;
+	Instr * i = loc->i;
+	Var * var;
+	UInt32 idx;
 
-	LiveInfo info;
+	if (i->op == INSTR_LET_ADR) {
+		var = VarRoot(i->arg1);
+		if (var != NULL && VarInSet(var, &idx)) {
+			LiveSetInclude(exposed, idx);
+		}
+	}
+	return false;
+}
+
+void LiveVariableAnalysis(Var * proc)
+/*
+Purpose:
+	Compute set of variables live at the beginning of every block of the procedure.
+	The set is stored as analysis data of the block and is valid until FreeLiveVariableAnalysis is called.
+*/
+{
 	InstrBlock * blk;
-	LiveSet set;
-	UInt16 i, count;
+	LiveSet exposed;
+	UInt32 n, count;
+	Var * var;
+
+	VarSetInit(&LIVE.vars);
+	ProcReferencedVars(proc, &LIVE.vars);
+	count = LIVE.count = VarSetCount(&LIVE.vars);
+
+	MemArenaInit(&LIVE.arena, 0);
+	LIVE.exit = LiveSetAlloc(&LIVE.arena, count);
+	LIVE.call = LiveSetAlloc(&LIVE.arena, count);
+	LIVE.tmp  = LiveSetAlloc(&LIVE.arena, count);
+	exposed   = LiveSetAlloc(&LIVE.arena, count);
+	LIVE.procs = NULL;
+
+	ProcInstrEnum(proc, &InstrMarkExposed, exposed);
+
+	// Non-private variables may be used by procedure without instructions and by reading using pointer.
+	// Registers and compiler temporaries are never used this way (unless address of temporary has been taken).
+	// At the end of procedure non-private variables are live too, except registers (there is no code after the end of root procedure).
+	// Output arguments are live at the end of procedure.
+
+	for (n=0; n<count; n++) {
+		var = VarSetItem(&LIVE.vars, n)->key;
+		if (VarIsPrivate(proc, var, exposed)) continue;
+		if (!VarIsReg(var) && (!VarIsTmp(var) || VarIsExposed(var, exposed))) LiveSetInclude(LIVE.call, n);
+		if (!VarIsReg(var) && proc != &ROOT_PROC) LiveSetInclude(LIVE.exit, n);
+	}
 
-	VarSetInit(&info.vars);
-	ProcReferencedVars(proc, &info.vars);
-	count = VarSetCount(&info.vars);
+	FOR_EACH_OUT_ARG(proc, var)
+		VarSetLiveness(LIVE.exit, var, VarLive);
+	NEXT_OUT_ARG
 
-	// Initialize variable live sets in every block
+	// Initialize variable live sets in every block (all variables are dead)
 
 	for (blk = proc->instr; blk != NULL; blk = blk->next) {
-		set = (LiveSet)MemAlloc(count);
-		for (i=0; i<count; i++) set[i] = VarLive;
-		blk->analysis_data = set;
+		blk->analysis_data = LiveSetAlloc(&LIVE.arena, count);
 	}
 
 	// Perform analysis
 
-	DataFlowAnalysis(proc, &AnalyzeLiveBlock, &info);
+	DataFlowAnalysis(proc, DATAFLOW_BACKWARD, &AnalyzeLiveBlock, NULL);
 	
 }
 
 void FreeLiveVariableAnalysis(Var * proc)
 {
+	InstrBlock * blk;
 
+	for (blk = proc->instr; blk != NULL; blk = blk->next) {
+		blk->analysis_data = NULL;
+	}
+	MemArenaFree(&LIVE.arena);
+	VarSetCleanup(&LIVE.vars);
+	LIVE.count = 0;
 }
 
-Bool OptimizeLive2(Var * proc)
+static Bool VarIsDeadIn(LiveSet set, Var * var)
+/*
+Purpose:
+	Test, that the value written to the variable is never read.
+*/
 {
-	return false;
+	UInt32 idx;
+
+	if (var == NULL) return true;
+
+	switch(var->mode) {
+	case INSTR_TUPLE:
+		return VarIsDeadIn(set, var->adr) && VarIsDeadIn(set, var->var);
+
+	case INSTR_VAR:
+		if (OutVar(var)) return false;
+		if (!VarInSet(var, &idx) || LiveSetTest(set, idx)) return false;
+
+		// Alias is dead only if the aliased variable is dead too
+		if (var->adr != NULL && !VarIsConst(var->adr)) {
+			return VarIsDeadIn(set, var->adr);
+		}
+		return true;
+
+	// Store to array element, byte or bit does not overwrite whole variable and store using pointer may write any variable,
+	// so these are never considered dead.
+	case INSTR_ELEMENT:
+	case INSTR_BYTE:
+	case INSTR_BIT:
+	case INSTR_DEREF:
+	default:
+		return false;
+	}
+}
+
+static Bool InstrIsDeadStore(Instr * i, LiveSet set)
+{
+	InstrInfo * ii = &INSTR_INFO[i->op];
+	Var * result = i->result;
+
+	if (result == NULL || i->rule == NULL) return false;
+	if (ii->arg_type[0] == TYPE_VOID || ii->arg_type[0] == TYPE_LABEL || ii->arg_type[0] == TYPE_PROC) return false;
+
+	switch(i->op) {
+	case INSTR_LABEL:
+	case INSTR_CALL:
+	case INSTR_ALLOC:
+	case INSTR_VARDEF:
+	case INSTR_PROC:
+	case INSTR_ENDPROC:
+		return false;
+	default:
+		break;
+	}
+
+	if (VarIsLabel(result) || VarIsArray(result)) return false;
+
+	// Prevent removing instructions, that read IN SEQUENCE variable
+	if (i->arg1 != NULL && FlagOn(i->arg1->submode, SUBMODE_IN_SEQUENCE)) return false;
+	if (i->arg2 != NULL && FlagOn(i->arg2->submode, SUBMODE_IN_SEQUENCE)) return false;
+
+	return VarIsDeadIn(set, result) && VarIsDeadIn(set, i->rule->flags);
 }
 
+Bool OptimizeLive2(Var * proc)
+/*
+Purpose:
+	Remove instructions, whose results (including registers and flags) are dead on every path through the procedure.
+	Unlike OptimizeLive, variable liveness is computed for whole procedure using data flow analysis.
+*/
+{
+	Bool modified = false;
+	InstrBlock * blk;
+	Instr * i, * prev;
+	LiveSet set;
+	UInt8 color;
+
+	if (Verbose(proc)) {
+		PrintHeader(3, "optimize live2", proc->name);
+		PrintProc(proc);
+	}
+
+	LiveVariableAnalysis(proc);
+	set = LIVE.tmp;
+
+	for(blk = proc->instr; blk != NULL; blk = blk->next) {
+
+		BlockLiveOut(blk, set);
+
+		for(i = blk->last; i != NULL; i = prev) {
+			prev = i->prev;
+			if (InstrIsDeadStore(i, set)) {
+				if (Verbose(proc)) {
+					color = PrintColor(OPTIMIZE_COLOR);
+					PrintFmt("Removing dead %ld:", blk->seq_no); InstrPrint(i);
+					PrintColor(color);
+				}
+				InstrDelete(blk, i);
+				modified = true;
+				continue;
+			}
+			InstrLiveness(proc, i, set);
+		}
+	}
+
+	FreeLiveVariableAnalysis(proc);
+	return modified;
+}
@@ -232,14 +232,12 @@ void OptimizeLoopShift(Var * proc)
 
 	loc.proc = proc;
 
+	MarkLoops(proc);
+
 	for(loc.blk = proc->instr; loc.blk != NULL; loc.blk = loc.blk->next) {
-		header = NULL;
-		if (loc.blk->jump_type == JUMP_LOOP) {
-			header = loc.blk->cond_to;
-			if (header == NULL) header = loc.blk->to;
-		}
+		for(header = loc.blk->loop_header; header != NULL; header = header->loop_parent) {
+			if (header->loop_end != loc.blk) continue;
 
-		if (header != NULL) {
 			i = LastInstr(loc.blk);
 
 			if (i != NULL && IS_INSTR_BRANCH(i->op)) {
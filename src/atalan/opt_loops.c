@@ -232,11 +232,16 @@ retry:
 	return false;
 }
 
-Bool LetCycles(Var * result, Var * arg1, UInt16 * p_q)
+Bool LetCost(Var * result, Var * arg1, UInt16 loop_depth, UInt32 * p_q)
+/*
+Purpose:
+	Compute cost of instruction assigning arg1 to result (see RuleCost).
+	Return false, if there is no such instruction.
+*/
 {
 	Rule * rule = InstrRule2(INSTR_LET, result, arg1, NULL);
 	if (rule != NULL) {
-		*p_q = rule->cycles;
+		*p_q = RuleCost(rule, loop_depth);
 		return true;
 	} else {
 		*p_q = 0;
@@ -259,7 +264,8 @@ Arguments:
 */{
 	Var * prev_var;
 	Int32 q;
-	UInt16 cycles;
+	UInt32 cost;
+	UInt16 depth;
 	UInt16 changed;
 	InstrBlock * blk, * blk_exit;
 	Instr * i, ti;
@@ -271,6 +277,10 @@ Arguments:
 
 	blk_exit = end->next;
 
+	// All instructions are compared as if they were in the loop header, so the initialization
+	// before the loop is considered to be as expensive as instructions in the loop.
+	depth = header->loop_depth;
+
 	// At the beginning, the quotient is 0.
 	ResetValues();
 	initial.op = INSTR_LET; initial.result = reg; initial.arg1 = top_var; initial.arg2 = NULL;
@@ -310,7 +320,7 @@ Arguments:
 				if (!InVar(i->arg1) && !OutVar(i->result) && VarContains(i->result, i->arg1)) {
 					if (mod_reg) first_init = false;
 					ASSERT(i->rule->cycles > 0);
-					q -= i->rule->cycles;
+					q -= RuleCost(i->rule, depth);
 					continue;
 				}
 			}
@@ -331,8 +341,8 @@ Arguments:
 			// we need to load the value to register first.
 			if (InstrReadsVar(i, top_var)) {
 				if (!VarContains(reg, top_var)) {
-					if (!(i->op == INSTR_LET && i->result == reg && i->arg1 == top_var) && LetCycles(reg, top_var, &cycles)) {
-						q += cycles;
+					if (!(i->op == INSTR_LET && i->result == reg && i->arg1 == top_var) && LetCost(reg, top_var, depth, &cost)) {
+						q += cost;
 					}
 					reg_use = 0;
 					// We may not had to add the load, but we still can not remove this instruction, so do not
@@ -343,7 +353,7 @@ Arguments:
 
 			// If we assign the register back to variable, we may remove this instruction
 			if (i->op == INSTR_LET && (i->result == top_var && i->arg1 == reg)) {
-				q -= i->rule->cycles;
+				q -= RuleCost(i->rule, depth);
 				continue;
 			} else {
 
@@ -351,8 +361,8 @@ Arguments:
 				// we need to save the register and load some other.
 
 				if (InstrUsesVar(i, reg) && !VarContains(reg, top_var)) {
-					if (prev_var != NULL && LetCycles(reg, top_var, &cycles)) {
-						q += cycles;
+					if (prev_var != NULL && LetCost(reg, top_var, depth, &cost)) {
+						q += cost;
 					}
 				}
 			}
@@ -361,16 +371,16 @@ Arguments:
 			// If the register is currently used for some different purpose, we must spill it.
 
 			if (i->result == top_var && !VarContains(reg, top_var)) {
-				if (i->next_use[0] != NULL && LetCycles(top_var, reg, &cycles)) {
-					q += cycles;		// TODO: we should use some temporary variable here
+				if (i->next_use[0] != NULL && LetCost(top_var, reg, depth, &cost)) {
+					q += cost;		// TODO: we should use some temporary variable here
 				}
 
 				//TODO: In this case, we will need to load the register later, when it is used
 				//We should handle the situation.
 			// Will it be necessary to spill?
 			// We use the variable (array) that is stored to register
-			} else if (InstrSpill(i, top_var) && LetCycles(top_var, reg, &cycles)) {
-				q += cycles;
+			} else if (InstrSpill(i, top_var) && LetCost(top_var, reg, depth, &cost)) {
+				q += cost;
 			}
 
 			memcpy(&ti, i, sizeof(Instr));
@@ -383,7 +393,7 @@ Arguments:
 			if (changed > 0) {
 
 				if (ti.op == INSTR_LET && ti.result == ti.arg1) {
-					q -= i->rule->cycles;
+					q -= RuleCost(i->rule, depth);
 					continue;
 				} 
 				rule = InstrRule(&ti);
@@ -396,9 +406,9 @@ Arguments:
 					}
 				} else {
 					ASSERT(rule->cycles > 0);
-					if (i->rule->cycles >= rule->cycles) {
-						q -= i->rule->cycles;			// we remove the current instruction
-						q += rule->cycles;              // and add new instruction
+					if (RuleCost(i->rule, depth) >= RuleCost(rule, depth)) {
+						q -= RuleCost(i->rule, depth);	// we remove the current instruction
+						q += RuleCost(rule, depth);     // and add new instruction
 					}
 				}
 			}
@@ -433,8 +443,8 @@ next:
 	// We must load it before first use.
 
 	if (!*p_init) {
-		if (LetCycles(reg, top_var, &cycles)) {
-			q += cycles;
+		if (LetCost(reg, top_var, depth, &cost)) {
+			q += cost;
 		}
 	}
 done:
@@ -507,112 +517,19 @@ Bool VarIsLoopDependent(Var * var, VarSet * liveset)
 	return false;
 }
 
-void DefsAdd(Defs * defs, InstrBlock * blk, Instr * i)
-{
-	Loc * def = &defs->defs[defs->count];
-	def->blk = blk;
-	def->i   = i;
-	defs->count++;
-}
-
-void DefsInit(Defs * defs)
-{
-	defs->count = 0;
-}
-
 Bool LoopContainsBlock(Loop * loop, InstrBlock * blk)
 {
-	return loop->header->seq_no <= blk->seq_no && loop->end->seq_no >= blk->seq_no;
-}
-
-void ReachingDefsBlock(Var * var, Loc * loc, InstrBlock * blk, Instr * instr, Defs * defs)
-{
-	Instr * i;
-	InstrBlock * caller;
-
-	if (blk == NULL || blk->processed) return;
-	if (instr == NULL) {
-		i = blk->last;
-	} else {
-		i = instr->prev;
-	}
-
-	// Definition of the variable may be in this block
-	for(; i != NULL; i = i->prev) {
-		if (i->op == INSTR_LINE) continue;
-		if (i->result == var) {
-			DefsAdd(defs, blk, i);
-			return;
-		}
-	}
-
-	// Or it may be in some calling blocks
-	
-	// If we haven't parsed whole block, do not mark it as processed to allow parsing rest of the instructions.
-	// In case this is loop block, we will parse it again, but parsing will stop at defining instruction.
-	if (instr == NULL) {
-		blk->processed = true;
-	}
-	ReachingDefsBlock(var, loc, blk->from, NULL, defs);
-
-	for(caller = blk->callers; caller != NULL; caller = caller->next_caller) {
-		ReachingDefsBlock(var, loc, caller, NULL, defs);
-	}
-}
-
-void ReachingDefs(Var * proc, Var * var, Loc * loc, Defs * defs)
-{
-	MarkBlockAsUnprocessed(proc->instr);
-	DefsInit(defs);
-	ReachingDefsBlock(var, loc, loc->blk, loc->i, defs);
-}
-
-void NextDefsBlock(Var * var, Loc * loc, InstrBlock * blk, Instr * instr, Defs * defs)
-{
-	Instr * i;
-
-	if (blk == NULL || blk->processed) return;
-
-	// If the starting instruction is not defined, we use first instruction, otherwise we start from following instruction
-	// (the specified one is the one we search for).
-	if (instr == NULL) {
-		i = blk->first;
-		blk->processed = true;
-	} else {
-		i = instr->next;
-	}
-
-	// Next definition may be in this block
-	for(; i != NULL; i = i->next) {
-		if (i->op == INSTR_LINE) continue;
-		if (i->result == var && !VarUsesVar(i->arg1, i->result) && !VarUsesVar(i->arg2, i->result)) {
-			DefsAdd(defs, blk, i);
-			return;
-		}
+	InstrBlock * header;
+	for(header = blk->loop_header; header != NULL; header = header->loop_parent) {
+		if (header == loop->header) return true;
 	}
-
-	// Or it may be in some calling blocks
-	
-	// If we haven't parsed whole block, do not mark it as processed to allow parsing rest of the instructions.
-	// In case this is loop block, we will parse it again, but parsing will stop at defining instruction.
-//	if (instr == NULL) {
-//		blk->processed = true;
-//	}
-	NextDefsBlock(var, loc, blk->to, NULL, defs);
-	NextDefsBlock(var, loc, blk->cond_to, NULL, defs);
-}
-
-void NextDefs(Var * proc, Var * var, Loc * loc, Defs * defs)
-{
-	MarkBlockAsUnprocessed(proc->instr);
-	DefsInit(defs);
-	NextDefsBlock(var, loc, loc->blk, loc->i, defs);
+	return false;
 }
 
-Bool VarInvariant(Var * proc, Var * var, Loc * loc, Loop * loop)
+Bool VarInvariant(ReachDefs * rd, Var * var, Loc * loc, Loop * loop)
 {
 	Defs defs;
-	UInt16 n;
+	UInt32 n;
 	Bool out_of_loop;
 
 	if (var == NULL) return true;
@@ -621,11 +538,10 @@ Bool VarInvariant(Var * proc, Var * var, Loc * loc, Loop * loop)
 
 	// For array access, array adr is constant (except referenced array), important is index change
 	if (var->mode == INSTR_ELEMENT || var->mode == INSTR_BYTE) {
-		return VarInvariant(proc, var->var, loc, loop);
+		return VarInvariant(rd, var->var, loc, loop);
 	}
 
-	DefsInit(&defs);
-	ReachingDefs(proc, var, loc, &defs);
+	ReachingDefs(rd, var, loc, &defs);
 
 	// 0 would be undefined variable
 
@@ -641,36 +557,16 @@ Bool VarInvariant(Var * proc, Var * var, Loc * loc, Loop * loop)
 	return defs.count == 1 && FlagOn(defs.defs[0].i->flags, InstrInvariant);
 }
 
-Bool VarLoopDepBlock(Var * var, Loc * loc, InstrBlock * blk, Instr * instr)
+Bool VarLoopDep(ReachDefs * rd, Var * var, Loc * loc, Loop * loop)
+/*
+Purpose:
+	Return true, if value of the variable after the instruction at the location may be used by some instruction,
+	that is not loop invariant.
+*/
 {
+	InstrBlock * blk;
 	Instr * i;
-
-	if (blk == NULL || blk->processed) return false;
-
-	// If the starting instruction is not defined, we use first instruction, otherwise we start from following instruction
-	// (the specified one is the one we search for).
-	if (instr == NULL) {
-		i = blk->first;
-		blk->processed = true;
-	} else {
-		i = instr->next;
-	}
-
-	// Next definition may be in this block
-	for(; i != NULL; i = i->next) {
-		if (i->op == INSTR_LINE) continue;
-		if (FlagOff(i->flags, InstrInvariant) && (VarUsesVar(i->arg1, var) || VarUsesVar(i->arg2, var))) {
-			return true;
-		}
-		// This instruction sets new value to variable
-		if (i->result == var) return false;
-	}
-
-	return VarLoopDepBlock(var, loc, blk->to, NULL) || VarLoopDepBlock(var, loc, blk->cond_to, NULL);
-}
-
-Bool VarLoopDep(Var * proc, Var * var, Loc * loc, Loop * loop)
-{
+	Loc use;
 
 	if (var == NULL) return false;
 	if (VarIsConst(var)) return false;
@@ -678,20 +574,28 @@ Bool VarLoopDep(Var * proc, Var * var, Loc * loc, Loop * loop)
 
 	// For array access, array adr is constant (except referenced array), important is index change
 	if (var->mode == INSTR_ELEMENT || var->mode == INSTR_BYTE) {
-		return VarLoopDep(proc, var->var, loc, loop);
+		return VarLoopDep(rd, var->var, loc, loop);
 	}
 
-	MarkBlockAsUnprocessed(proc->instr);
-	
-	return VarLoopDepBlock(var, loc, loc->blk, loc->i);
-
+	use.proc = rd->proc;
+	for(blk = rd->proc->instr; blk != NULL; blk = blk->next) {
+		use.blk = blk;
+		for(i = blk->first; i != NULL; i = i->next) {
+			if (i->op == INSTR_LINE) continue;
+			if (FlagOff(i->flags, InstrInvariant) && (VarUsesVar(i->arg1, var) || VarUsesVar(i->arg2, var))) {
+				use.i = i;
+				if (DefsReach(rd, var, loc, &use)) return true;
+			}
+		}
+	}
+	return false;
 }
 
-Bool VarInvariant2(Var * proc, Var * var, Loc * loc, Loop * loop)
+Bool VarInvariant2(ReachDefs * rd, Var * var, Loc * loc, Loop * loop)
 {
 	Defs defs;
 
-	NextDefs(proc, var, loc, &defs);
+	NextDefs(rd, var, loc, &defs);
 
 	// In loop, number of definitions may be 0 in case of loop variables
 	//:::::::::::::::::::::
@@ -737,7 +641,13 @@ void PrintLoopInvariants(Loop * loop)
 	}
 }
 
-void OptimizeLoopInvariants(Var * proc, Loop * loop)
+void OptimizeLoopInvariants(Var * proc, Loop * loop, ReachDefs * rd)
+/*
+Purpose:
+	Move loop invariant instructions to loop preheader.
+	Reaching definitions are computed, if they are not up to date.
+	They are released when some instruction has been moved.
+*/
 {
 	InstrBlock * blk, * blk_exit;
 	Instr * i, * i2;
@@ -750,6 +660,8 @@ void OptimizeLoopInvariants(Var * proc, Loop * loop)
 
 	blk_exit = loop->end->next;
 
+	ReachingDefsAnalysis(proc, rd);
+
 	//=== Mark all instructions as variant
 
 	for(blk = loop->header; blk != blk_exit; blk = blk->next) {
@@ -767,8 +679,8 @@ void OptimizeLoopInvariants(Var * proc, Loop * loop)
 				if (i->op == INSTR_LINE || IS_INSTR_BRANCH(i->op)) continue;
 				if (FlagOff(i->flags, InstrInvariant)) {
 					if (i->result != NULL && !OutVar(i->result)) {
-						if (VarInvariant(proc, i->arg1, &loc, loop) && VarInvariant(proc, i->arg2, &loc, loop)) {
-							if (VarInvariant2(proc, i->result, &loc, loop)) {
+						if (VarInvariant(rd, i->arg1, &loc, loop) && VarInvariant(rd, i->arg2, &loc, loop)) {
+							if (VarInvariant2(rd, i->result, &loc, loop)) {
 								SetFlagOn(i->flags, InstrInvariant);
 								change = true;
 							}
@@ -830,6 +742,7 @@ void OptimizeLoopInvariants(Var * proc, Loop * loop)
 			i2 = i->next;
 			if (FlagOn(i->flags, InstrInvariant)) {
 				InstrMoveCode(preheader.blk, preheader.i, blk, i, i);
+				FreeReachingDefs(rd);
 			}
 			i = i2;
 		}
@@ -858,7 +771,7 @@ void PrintInsert(Instr * i)
 void LoopInsertPrologue(Var * proc, InstrBlock * header, InstrOp op, Var * result, Var * arg1, Var * arg2)
 {
 
-	Instr * i = MemAllocStruct(Instr);
+	Instr * i = InstrAlloc();
 	i->op = op;
 	i->result = result;
 	i->arg1 = arg1;
@@ -872,7 +785,7 @@ void LoopInsertPrologue(Var * proc, InstrBlock * header, InstrOp op, Var * resul
 void InstrInsertRule(InstrBlock * blk, Instr * before, InstrOp op, Var * result, Var * arg1, Var * arg2)
 {
 
-	Instr * i = MemAllocStruct(Instr);
+	Instr * i = InstrAlloc();
 	i->op = op;
 	i->result = result;
 	i->arg1 = arg1;
@@ -1091,7 +1004,7 @@ del2:					if (verbose) { PrintDelete(); }
 					}
 
 					rule = InstrRule(&ti);
-					if (rule != NULL && (i->rule->cycles >= rule->cycles)) {
+					if (rule != NULL && (RuleCost(i->rule, header->loop_depth) >= RuleCost(rule, header->loop_depth))) {
 						InstrReplaceVar(i, top_var, top_reg);
 
 						if (i->arg1 != reg && VarContains(i->arg1, reg)) {
@@ -1156,32 +1069,35 @@ del2:					if (verbose) { PrintDelete(); }
 	return false;
 }
 
+static Var * LOOPS_PROC;		// procedure, for which the loops have been computed
+static UInt32 LOOPS_STAMP;		// value of CFG_STAMP when the loops have been computed
+
 void MarkLoops(Var * proc)
+/*
+Purpose:
+	Compute dominator tree and loop nesting forest of the procedure (see LoopForest).
+	Loop depth of every block is computed too.
+	The information is computed only if the control flow graph has changed since the last call.
+*/
 {
 	InstrBlock * blk;
+
+	if (proc == LOOPS_PROC && CFG_STAMP == LOOPS_STAMP) return;
+
 	NumberBlocks(proc->instr);
+	LoopForest(proc);
 
 	for(blk = proc->instr; blk != NULL; blk = blk->next) {
 		blk->jump_type = JUMP_IF;
 	}
 
-	// Test for each block, if it is end of an loop
-
+	// Mark blocks ending the loops
 	for(blk = proc->instr; blk != NULL; blk = blk->next) {
-		if (blk->cond_to != NULL) {
-			// We jump to some previous spot in the sequence
-			if (blk->cond_to->seq_no <= blk->seq_no) {
-				blk->jump_type = JUMP_LOOP;	//->cond_to->loop_end = blk;
-			}
-		}
-
-		if (blk->to != NULL) {
-			if (blk->to->seq_no <= blk->seq_no) {
-				blk->jump_type = JUMP_LOOP;	//to->loop_end = blk;
-			}
-		}
+		if (blk->loop_end != NULL) blk->loop_end->jump_type = JUMP_LOOP;
 	}
 
+	LOOPS_PROC  = proc;
+	LOOPS_STAMP = CFG_STAMP;
 }
 
 Bool OptimizeLoops(Var * proc)
@@ -1192,9 +1108,11 @@ Purpose:
 {
 	Loop loop;
 	InstrBlock * nb, * header;
+	ReachDefs rd;
 	Bool modified = false;
 
 	MarkLoops(proc);
+	ReachingDefsInit(&rd);
 
 	if (Verbose(proc)) {
 		PrintHeader(3, "Optimize loops");
@@ -1202,27 +1120,24 @@ Purpose:
 	}
 
 
-	for(nb = proc->instr; nb != NULL; nb = nb->next) {
-		header = NULL;
+	// Loops are processed in the order of their ends, so inner loops are processed before outer loops.
 
-		if (nb->jump_type == JUMP_LOOP) {
-			header = nb->cond_to;
-			if (header == NULL) header = nb->to;
-		}
-//		if (nb->cond_to != NULL && nb->cond_to->loop_end == nb) header = nb->cond_to;
-//		if (nb->to != NULL && nb->to->loop_end == nb) header = nb->to;
-
-		if (header != NULL) {
+	for(nb = proc->instr; nb != NULL; nb = nb->next) {
+		for(header = nb->loop_header; header != NULL; header = header->loop_parent) {
+			if (header->loop_end != nb) continue;
 //			if (Verbose(proc)) {
 //				Print("*** Loop %d..%d\n", header->seq_no, nb->seq_no);
 //			}
 			loop.header = header;
 			loop.end    = nb;
-//			OptimizeLoopInvariants(proc, &loop);
-			modified |= OptimizeLoop(proc, header, nb);
+//			OptimizeLoopInvariants(proc, &loop, &rd);
+			if (OptimizeLoop(proc, header, nb)) {
+				FreeReachingDefs(&rd);
+				modified = true;
+			}
 		}
-
 	}
 
+	FreeReachingDefs(&rd);
 	return modified;
 }
@@ -0,0 +1,336 @@
+/*
+
+Reaching definitions analysis
+
+(c) 2012 Rudolf Kudla
+Licensed under the MIT license: http://www.opensource.org/licenses/mit-license.php
+
+See: http://en.wikipedia.org/wiki/Reaching_definition
+
+*/
+
+#include "language.h"
+
+/*
+Definition is an instruction setting a variable (the variable is the result of the instruction).
+Definition reaches some point of the procedure, if there is a path from the definition to the point,
+on which the variable is not set again.
+
+All definitions of the procedure are numbered so, that definitions of one variable have consecutive numbers.
+Sets of definitions reaching the start and the end of every block are computed using data flow solver
+and stored as bit sets of definition numbers (see LiveSet).
+
+Definitions reaching an instruction are then found by scanning preceding instructions of the block
+and if there is no definition of the variable, by looking up the part of the block set belonging to the variable.
+*/
+
+// Marks of definitions used by queries
+
+#define DEF_REACHED    1		// definition is reached by the value
+#define DEF_PROPAGATES 2		// definition propagates the value to following definitions
+
+typedef struct {
+	ReachDefs * rd;
+	LiveSet * gen;		// definitions in the block reaching its end
+	LiveSet * kill;		// all definitions of variables defined in the block
+	LiveSet   tmp;
+} ReachInfo;
+
+static Bool InstrIsDef(Instr * i)
+{
+	return i->result != NULL && i->op != INSTR_LINE && !IS_INSTR_JUMP(i->op);
+}
+
+static Bool InstrIsSelfDef(Instr * i)
+/*
+Purpose:
+	Return true, if the instruction modifies its result using its previous value (like x = x + 1).
+*/
+{
+	return VarUsesVar(i->arg1, i->result) || VarUsesVar(i->arg2, i->result);
+}
+
+void ReachingDefsInit(ReachDefs * rd)
+{
+	rd->proc = NULL;
+	rd->count = 0;
+	VarSetInit(&rd->vars);
+	MemArenaInit(&rd->arena, 0);
+}
+
+void FreeReachingDefs(ReachDefs * rd)
+/*
+Purpose:
+	Release computed reaching definitions.
+	Must be called, when the code of the procedure has been modified, so the definitions are computed again by next analysis.
+*/
+{
+	VarSetCleanup(&rd->vars);
+	MemArenaFree(&rd->arena);
+	rd->proc  = NULL;
+	rd->count = 0;
+}
+
+static Bool ReachBlock(Var * proc, InstrBlock * blk, void * data)
+{
+	ReachInfo * info = (ReachInfo *)data;
+	ReachDefs * rd = info->rd;
+	InstrBlock * caller;
+	LiveSet in;
+	UInt32 n;
+	Bool changed;
+
+	n  = blk->seq_no - 1;
+	in = rd->in[n];
+
+	LiveSetClear(in, rd->count);
+	if (blk->from != NULL) {
+		LiveSetUnion(in, rd->out[blk->from->seq_no - 1], rd->count);
+	}
+	for(caller = blk->callers; caller != NULL; caller = caller->next_caller) {
+		LiveSetUnion(in, rd->out[caller->seq_no - 1], rd->count);
+	}
+
+	LiveSetCopy(info->tmp, in, rd->count);
+	LiveSetDifference(info->tmp, info->kill[n], rd->count);
+	LiveSetUnion(info->tmp, info->gen[n], rd->count);
+
+	changed = !LiveSetEqual(info->tmp, rd->out[n], rd->count);
+	if (changed) {
+		LiveSetCopy(rd->out[n], info->tmp, rd->count);
+	}
+	return changed;
+}
+
+void ReachingDefsAnalysis(Var * proc, ReachDefs * rd)
+/*
+Purpose:
+	Compute definitions reaching every block of the procedure.
+	If the definitions have already been computed for the procedure and its control flow graph has not changed since,
+	nothing is done.
+	Blocks of the procedure are numbered (seq_no) by the analysis.
+*/
+{
+	ReachInfo info;
+	InstrBlock * blk;
+	Instr * i;
+	Loc * def;
+	UInt32 blk_cnt, var_cnt, v, n, k, first, * fill;
+
+	if (rd->proc == proc && rd->stamp == CFG_STAMP) return;
+	FreeReachingDefs(rd);
+
+	// Number the blocks and find defined variables
+
+	blk_cnt = 0;
+	for(blk = proc->instr; blk != NULL; blk = blk->next) {
+		blk->seq_no = ++blk_cnt;
+		for(i = blk->first; i != NULL; i = i->next) {
+			if (InstrIsDef(i)) VarSetAdd(&rd->vars, i->result, NULL);
+		}
+	}
+	var_cnt = VarSetCount(&rd->vars);
+
+	// Number the definitions, so that definitions of one variable are consecutive
+
+	rd->var_defs = (UInt32 *)MemArenaAllocEmpty(&rd->arena, sizeof(UInt32) * (var_cnt + 1));
+	for(blk = proc->instr; blk != NULL; blk = blk->next) {
+		for(i = blk->first; i != NULL; i = i->next) {
+			if (InstrIsDef(i)) {
+				VarSetFindIndex(&rd->vars, i->result, &v);
+				rd->var_defs[v + 1]++;
+			}
+		}
+	}
+	for(v = 0; v < var_cnt; v++) {
+		rd->var_defs[v + 1] += rd->var_defs[v];
+	}
+	rd->count = rd->var_defs[var_cnt];
+
+	rd->defs  = (Loc *)MemArenaAlloc(&rd->arena, sizeof(Loc) * (rd->count + 1));
+	rd->found = (UInt32 *)MemArenaAlloc(&rd->arena, sizeof(UInt32) * (rd->count + 1));
+	rd->mark  = (UInt8 *)MemArenaAllocEmpty(&rd->arena, sizeof(UInt8) * (rd->count + 1));
+	rd->result = (Loc *)MemArenaAlloc(&rd->arena, sizeof(Loc) * (rd->count + 1));
+	rd->in    = (LiveSet *)MemArenaAlloc(&rd->arena, sizeof(LiveSet) * blk_cnt);
+	rd->out   = (LiveSet *)MemArenaAlloc(&rd->arena, sizeof(LiveSet) * blk_cnt);
+
+	info.rd   = rd;
+	info.gen  = (LiveSet *)MemArenaAlloc(&rd->arena, sizeof(LiveSet) * blk_cnt);
+	info.kill = (LiveSet *)MemArenaAlloc(&rd->arena, sizeof(LiveSet) * blk_cnt);
+	info.tmp  = LiveSetAlloc(&rd->arena, rd->count);
+
+	fill = (UInt32 *)MemAlloc(sizeof(UInt32) * (var_cnt + 1));
+	MemMove(fill, rd->var_defs, sizeof(UInt32) * (var_cnt + 1));
+
+	// Block generates its last definition of every variable and kills all definitions of variables it defines
+
+	for(blk = proc->instr; blk != NULL; blk = blk->next) {
+		n = blk->seq_no - 1;
+		rd->in[n]   = LiveSetAlloc(&rd->arena, rd->count);
+		rd->out[n]  = LiveSetAlloc(&rd->arena, rd->count);
+		info.gen[n] = LiveSetAlloc(&rd->arena, rd->count);
+		info.kill[n] = LiveSetAlloc(&rd->arena, rd->count);
+
+		for(i = blk->first, k = 1; i != NULL; i = i->next, k++) {
+			if (!InstrIsDef(i)) continue;
+			VarSetFindIndex(&rd->vars, i->result, &v);
+			def = &rd->defs[fill[v]];
+			def->proc = proc;
+			def->blk  = blk;
+			def->i    = i;
+			def->n    = k;
+
+			first = rd->var_defs[v];
+			for(; first < rd->var_defs[v + 1]; first++) {
+				LiveSetInclude(info.kill[n], first);
+				LiveSetExclude(info.gen[n], first);
+			}
+			LiveSetInclude(info.gen[n], fill[v]);
+			fill[v]++;
+		}
+	}
+	MemFree(fill);
+
+	DataFlowAnalysis(proc, DATAFLOW_FORWARD, &ReachBlock, &info);
+
+	rd->proc  = proc;
+	rd->stamp = CFG_STAMP;
+}
+
+static UInt32 FindDefs(ReachDefs * rd, Var * var, Loc * loc)
+/*
+Purpose:
+	Find definitions of the variable reaching the location (before the instruction loc->i is executed).
+	If loc->i is NULL, definitions reaching the end of the block are found.
+	Numbers of the definitions are stored to rd->found, their count is returned.
+*/
+{
+	Instr * i;
+	LiveSet set;
+	UInt32 v, n, first, last, cnt;
+
+	if (var == NULL || !VarSetFindIndex(&rd->vars, var, &v)) return 0;
+
+	first = rd->var_defs[v];
+	last  = rd->var_defs[v + 1];
+
+	// Variable may be defined by preceding instruction in the same block
+
+	i = (loc->i == NULL) ? loc->blk->last : loc->i->prev;
+	for(; i != NULL; i = i->prev) {
+		if (InstrIsDef(i) && i->result == var) {
+			for(n = first; rd->defs[n].i != i; n++);
+			rd->found[0] = n;
+			return 1;
+		}
+	}
+
+	// Otherwise it is defined by definitions reaching the start of the block
+
+	cnt = 0;
+	set = rd->in[loc->blk->seq_no - 1];
+	for(n = LiveSetNext(set, last, first); n < last; n = LiveSetNext(set, last, n + 1)) {
+		rd->found[cnt++] = n;
+	}
+	return cnt;
+}
+
+void ReachingDefs(ReachDefs * rd, Var * var, Loc * loc, Defs * defs)
+/*
+Purpose:
+	Find definitions of the variable reaching the location (before the instruction loc->i is executed).
+	If loc->i is NULL, definitions reaching the end of the block are found.
+	Returned array of definitions is valid until next query.
+*/
+{
+	UInt32 n, cnt;
+
+	cnt = FindDefs(rd, var, loc);
+	for(n = 0; n < cnt; n++) {
+		rd->result[n] = rd->defs[rd->found[n]];
+	}
+	defs->defs  = rd->result;
+	defs->count = cnt;
+}
+
+Bool DefsReach(ReachDefs * rd, Var * var, Loc * from, Loc * to)
+/*
+Purpose:
+	Return true, if the value of the variable after the instruction from->i may be the value of the variable
+	at the location to (before the instruction to->i is executed).
+	If the instruction from->i does not define the variable, the test is conservative (all definitions reaching
+	the point after the instruction are considered).
+*/
+{
+	Loc after;
+	UInt32 n, cnt;
+	Bool reach;
+
+	after.proc = from->proc;
+	after.blk  = from->blk;
+	after.i    = from->i->next;
+	cnt = FindDefs(rd, var, &after);
+	for(n = 0; n < cnt; n++) rd->mark[rd->found[n]] = DEF_REACHED;
+
+	reach = false;
+	cnt = FindDefs(rd, var, to);
+	for(n = 0; n < cnt; n++) {
+		if (FlagOn(rd->mark[rd->found[n]], DEF_REACHED)) reach = true;
+	}
+
+	cnt = FindDefs(rd, var, &after);
+	for(n = 0; n < cnt; n++) rd->mark[rd->found[n]] = 0;
+
+	return reach;
+}
+
+void NextDefs(ReachDefs * rd, Var * var, Loc * loc, Defs * defs)
+/*
+Purpose:
+	Find definitions of the variable, that may replace the value set by the instruction at the location.
+	Instructions modifying the variable using its previous value (like x = x + 1) are not considered definitions,
+	definitions following them are found instead.
+	If the instruction at the location does not define the variable, no definitions are found.
+	Returned array of definitions is valid until next query.
+*/
+{
+	UInt32 v, n, k, first, last, cnt;
+	Bool change;
+
+	defs->defs  = rd->result;
+	defs->count = 0;
+
+	if (loc->i == NULL || !InstrIsDef(loc->i) || loc->i->result != var || !VarSetFindIndex(&rd->vars, var, &v)) return;
+
+	first = rd->var_defs[v];
+	last  = rd->var_defs[v + 1];
+
+	// Value set by the instruction is propagated by instructions modifying the variable.
+	// Definition is reached by the value, if some definition reaching it propagates the value.
+
+	for(n = first; rd->defs[n].i != loc->i; n++);
+	rd->mark[n] = DEF_PROPAGATES;
+
+	do {
+		change = false;
+		for(n = first; n < last; n++) {
+			if (FlagOn(rd->mark[n], DEF_REACHED)) continue;
+			for(k = FindDefs(rd, var, &rd->defs[n]); k > 0; k--) {
+				if (FlagOn(rd->mark[rd->found[k-1]], DEF_PROPAGATES)) break;
+			}
+			if (k == 0) continue;
+			rd->mark[n] |= DEF_REACHED;
+			if (InstrIsSelfDef(rd->defs[n].i)) rd->mark[n] |= DEF_PROPAGATES;
+			change = true;
+		}
+	} while(change);
+
+	cnt = 0;
+	for(n = first; n < last; n++) {
+		if (FlagOn(rd->mark[n], DEF_REACHED) && !InstrIsSelfDef(rd->defs[n].i)) {
+			rd->result[cnt++] = rd->defs[n];
+		}
+		rd->mark[n] = 0;
+	}
+	defs->count = cnt;
+}
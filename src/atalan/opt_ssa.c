@@ -0,0 +1,1019 @@
+/*
+
+Static single assignment form and sparse conditional constant propagation
+
+(c) 2012 Rudolf Kudla
+Licensed under the MIT license: http://www.opensource.org/licenses/mit-license.php
+
+*/
+
+#include "language.h"
+
+/*
+SSA form
+========
+
+SSA form is built as an overlay over the code of procedure, instructions themselves are not modified.
+Every definition of tracked variable gets its own SSA name and every use of the variable as instruction argument
+refers to the name, that reaches it.
+Phi nodes are placed at the dominance frontiers of blocks defining the variable (Cytron et al.) and names
+are assigned while walking the dominator tree computed by LoopForest.
+
+Phi nodes exist only in the overlay, they are never inserted into the code.
+Releasing the overlay is therefore all what is necessary to leave the SSA form.
+
+Only variables, whose every modification is visible as result of an instruction, are tracked.
+This excludes input and output variables, registers, variables with specified address or aliased by other variable,
+variables whose address is used and variables accessed as part of other variable (array element, byte, tuple).
+Procedure call may modify any variable, so it defines all tracked variables with unknown value.
+Values of variables at the procedure entry are unknown too.
+*/
+
+#define SSA_NONE 0xffffffff
+
+typedef enum {
+	SCCP_TOP = 0,		// value is not known yet (definition has not been executed)
+	SCCP_CONST,			// variable has constant value
+	SCCP_BOTTOM			// value is not constant
+} SccpState;
+
+typedef struct SsaNameTag SsaName;
+typedef struct SsaPhiTag SsaPhi;
+typedef struct SsaUseTag SsaUse;
+
+struct SsaUseTag {
+	SsaUse *  next;
+	UInt32    instr;		// index of instruction using the name (SSA_NONE for phi node)
+	SsaPhi *  phi;			// phi node using the name
+};
+
+struct SsaNameTag {
+	Var *     var;
+	UInt32    def;			// index of defining instruction (SSA_NONE for phi node and unknown value)
+	SsaUse *  uses;
+	SccpState state;
+	Var *     value;		// value of SCCP_CONST
+	Bool      queued;
+	SsaName * next_work;
+};
+
+struct SsaPhiTag {
+	SsaPhi *   next;		// next phi node in the same block
+	UInt32     blk;
+	SsaName *  result;
+	SsaName ** args;		// name for every predecessor of the block
+};
+
+typedef struct {
+	Var *      proc;
+	MemArena   arena;
+
+	// Blocks are indexed by seq_no - 1
+	UInt32          blk_cnt;
+	InstrBlock **   blks;
+	UInt32 *        idom;			// index of immediate dominator (SSA_NONE for entry and unreachable blocks)
+	UInt32 *        instr_first;	// instructions of block b are instr_first[b]..instr_first[b+1]-1
+	UInt32 *        pred_first;		// predecessors of block b are preds[pred_first[b]]..preds[pred_first[b+1]-1]
+	UInt32 *        preds;
+	SsaPhi **       phis;
+
+	// Instructions are indexed in order of blocks
+	UInt32          instr_cnt;
+	Instr **        instrs;
+	UInt32 *        instr_blk;
+	SsaName **      defs;			// name defined by the instruction
+	SsaName **      uses;			// names used as arg1 and arg2 of the instruction
+
+	// Tracked variables are indexed by set_index
+	UInt32          var_cnt;
+	UInt32          var_capacity;
+	Var **          vars;
+	Bool *          excluded;
+	SsaName **      cur;			// current name of every variable while renaming
+
+	SsaName         bottom;			// unknown value (defined at procedure entry and by procedure calls)
+
+	// Sparse conditional constant propagation
+	Bool *          exec_blk;
+	Bool *          exec_edge;		// for every predecessor
+	UInt32 *        edge_blk;		// block entered by the edge
+	UInt32 *        edge_work;
+	UInt32          edge_head, edge_tail;
+	SsaName *       name_work;
+} Ssa;
+
+static Bool SsaTrackable(Var * var)
+{
+	if (var->mode != INSTR_VAR || var->adr != NULL) return false;
+	if (FlagOn(var->submode, SUBMODE_IN | SUBMODE_OUT | SUBMODE_REG)) return false;
+	return var->type == NULL || var->type->variant == TYPE_INT;
+}
+
+static UInt32 SsaVarIndex(Ssa * ssa, Var * var)
+{
+	if (var != NULL && var->set_index < ssa->var_cnt && ssa->vars[var->set_index] == var) return var->set_index;
+	return SSA_NONE;
+}
+
+static void SsaAddVar(Ssa * ssa, Var * var, Bool exclude)
+{
+	UInt32 n = SsaVarIndex(ssa, var);
+
+	if (n == SSA_NONE) {
+		if (ssa->var_cnt == ssa->var_capacity) {
+			ssa->var_capacity = ssa->var_capacity * 2 + 16;
+			ssa->vars     = (Var **)realloc(ssa->vars, sizeof(Var *) * ssa->var_capacity);
+			ssa->excluded = (Bool *)realloc(ssa->excluded, sizeof(Bool) * ssa->var_capacity);
+		}
+		n = ssa->var_cnt++;
+		ssa->vars[n] = var;
+		ssa->excluded[n] = !SsaTrackable(var);
+		var->set_index = n;
+	}
+	if (exclude) ssa->excluded[n] = true;
+}
+
+static void SsaScanVar(Ssa * ssa, Var * var, Bool exclude)
+/*
+Purpose:
+	Register variable used in instruction.
+	Variables used as part of other variable are excluded, only array index is just read.
+*/
+{
+	if (var == NULL) return;
+
+	switch(var->mode) {
+	case INSTR_INT:
+	case INSTR_CONST:
+	case INSTR_TEXT:
+		break;
+
+	case INSTR_VAR:
+		if (var->adr != NULL) {
+			SsaScanVar(ssa, var->adr, true);
+			exclude = true;
+		}
+		SsaAddVar(ssa, var, exclude);
+		break;
+
+	case INSTR_ELEMENT:
+	case INSTR_BYTE:
+		SsaScanVar(ssa, var->adr, true);
+		SsaScanVar(ssa, var->var, exclude);
+		break;
+
+	default:
+		SsaScanVar(ssa, var->adr, true);
+		SsaScanVar(ssa, var->var, true);
+		break;
+	}
+}
+
+static Bool SsaKnownOp(InstrOp op)
+/*
+Purpose:
+	Return true, if the instruction only reads it's arguments and only writes it's result.
+	Variables used by other instructions are not tracked.
+*/
+{
+	switch(op) {
+	case INSTR_LET:
+	case INSTR_ADD:
+	case INSTR_SUB:
+	case INSTR_MUL:
+	case INSTR_DIV:
+	case INSTR_MOD:
+	case INSTR_AND:
+	case INSTR_OR:
+	case INSTR_XOR:
+	case INSTR_NOT:
+	case INSTR_SQRT:
+	case INSTR_LO:
+	case INSTR_HI:
+	case INSTR_ROL:
+	case INSTR_ROR:
+	case INSTR_GOTO:
+	case INSTR_CALL:
+	case INSTR_IFEQ:
+	case INSTR_IFNE:
+	case INSTR_IFLT:
+	case INSTR_IFGE:
+	case INSTR_IFGT:
+	case INSTR_IFLE:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static SsaName * SsaNewName(Ssa * ssa, Var * var, UInt32 def)
+{
+	SsaName * name = MemArenaAllocStruct(&ssa->arena, SsaName);
+	name->var = var;
+	name->def = def;
+	return name;
+}
+
+static void SsaAddUse(Ssa * ssa, SsaName * name, UInt32 instr, SsaPhi * phi)
+{
+	SsaUse * use;
+
+	// Unknown value never changes, so nobody must be informed about it's changes
+	if (name == &ssa->bottom) return;
+
+	use = MemArenaAllocStruct(&ssa->arena, SsaUse);
+	use->instr = instr;
+	use->phi   = phi;
+	use->next  = name->uses;
+	name->uses = use;
+}
+
+static UInt32 SsaPredSlot(Ssa * ssa, UInt32 blk, UInt32 pred)
+{
+	UInt32 k;
+	for(k = ssa->pred_first[blk]; k < ssa->pred_first[blk + 1]; k++) {
+		if (ssa->preds[k] == pred) return k;
+	}
+	return SSA_NONE;
+}
+
+static UInt32 SsaSuccessors(Ssa * ssa, UInt32 b, UInt32 * succ)
+{
+	InstrBlock * blk = ssa->blks[b];
+	UInt32 n = 0;
+	if (blk->to != NULL) succ[n++] = blk->to->seq_no - 1;
+	if (blk->cond_to != NULL && blk->cond_to != blk->to) succ[n++] = blk->cond_to->seq_no - 1;
+	return n;
+}
+
+static Bool SsaReachable(Ssa * ssa, UInt32 b)
+{
+	return b == 0 || ssa->idom[b] != SSA_NONE;
+}
+
+static void SsaBlocks(Ssa * ssa)
+/*
+Purpose:
+	Index blocks and instructions of the procedure and find predecessors of reachable blocks.
+*/
+{
+	InstrBlock * blk;
+	Instr * i;
+	UInt32 b, n, k, sc, succ[2], * fill;
+
+	ssa->blk_cnt = 0;
+	ssa->instr_cnt = 0;
+	for(blk = ssa->proc->instr; blk != NULL; blk = blk->next) {
+		ssa->blk_cnt++;
+		for(i = blk->first; i != NULL; i = i->next) ssa->instr_cnt++;
+	}
+
+	ssa->blks        = (InstrBlock **)MemArenaAlloc(&ssa->arena, sizeof(InstrBlock *) * ssa->blk_cnt);
+	ssa->idom        = (UInt32 *)MemArenaAlloc(&ssa->arena, sizeof(UInt32) * ssa->blk_cnt);
+	ssa->instr_first = (UInt32 *)MemArenaAlloc(&ssa->arena, sizeof(UInt32) * (ssa->blk_cnt + 1));
+	ssa->pred_first  = (UInt32 *)MemArenaAllocEmpty(&ssa->arena, sizeof(UInt32) * (ssa->blk_cnt + 1));
+	ssa->preds       = (UInt32 *)MemArenaAlloc(&ssa->arena, sizeof(UInt32) * 2 * ssa->blk_cnt);
+	ssa->phis        = (SsaPhi **)MemArenaAllocEmpty(&ssa->arena, sizeof(SsaPhi *) * ssa->blk_cnt);
+	ssa->instrs      = (Instr **)MemArenaAlloc(&ssa->arena, sizeof(Instr *) * ssa->instr_cnt);
+	ssa->instr_blk   = (UInt32 *)MemArenaAlloc(&ssa->arena, sizeof(UInt32) * ssa->instr_cnt);
+	ssa->defs        = (SsaName **)MemArenaAllocEmpty(&ssa->arena, sizeof(SsaName *) * ssa->instr_cnt);
+	ssa->uses        = (SsaName **)MemArenaAllocEmpty(&ssa->arena, sizeof(SsaName *) * 2 * ssa->instr_cnt);
+
+	b = 0; n = 0;
+	for(blk = ssa->proc->instr; blk != NULL; blk = blk->next, b++) {
+		ssa->blks[b] = blk;
+		ssa->idom[b] = (blk->idom != NULL) ? blk->idom->seq_no - 1 : SSA_NONE;
+		ssa->instr_first[b] = n;
+		for(i = blk->first; i != NULL; i = i->next, n++) {
+			ssa->instrs[n] = i;
+			ssa->instr_blk[n] = b;
+		}
+	}
+	ssa->instr_first[b] = n;
+
+	// Predecessors (unreachable blocks are ignored)
+
+	for(b = 0; b < ssa->blk_cnt; b++) {
+		if (!SsaReachable(ssa, b)) continue;
+		sc = SsaSuccessors(ssa, b, succ);
+		for(k = 0; k < sc; k++) ssa->pred_first[succ[k] + 1]++;
+	}
+	fill = (UInt32 *)MemArenaAlloc(&ssa->arena, sizeof(UInt32) * ssa->blk_cnt);
+	for(b = 0; b < ssa->blk_cnt; b++) {
+		ssa->pred_first[b + 1] += ssa->pred_first[b];
+		fill[b] = ssa->pred_first[b];
+	}
+	for(b = 0; b < ssa->blk_cnt; b++) {
+		if (!SsaReachable(ssa, b)) continue;
+		sc = SsaSuccessors(ssa, b, succ);
+		for(k = 0; k < sc; k++) ssa->preds[fill[succ[k]]++] = b;
+	}
+}
+
+static void SsaVars(Ssa * ssa)
+/*
+Purpose:
+	Find variables tracked in SSA form.
+*/
+{
+	UInt32 n, cnt;
+	Instr * i;
+	Bool exclude;
+
+	for(n = 0; n < ssa->instr_cnt; n++) {
+		i = ssa->instrs[n];
+		if (i->op == INSTR_LINE) continue;
+		exclude = !SsaKnownOp(i->op);
+		SsaScanVar(ssa, i->result, exclude);
+		SsaScanVar(ssa, i->arg1, exclude);
+		SsaScanVar(ssa, i->arg2, exclude);
+	}
+
+	// Keep only tracked variables
+
+	cnt = ssa->var_cnt;
+	ssa->var_cnt = 0;
+	for(n = 0; n < cnt; n++) {
+		if (!ssa->excluded[n]) {
+			ssa->vars[ssa->var_cnt] = ssa->vars[n];
+			ssa->vars[ssa->var_cnt]->set_index = ssa->var_cnt;
+			ssa->var_cnt++;
+		}
+	}
+}
+
+static void SsaPlacePhis(Ssa * ssa)
+/*
+Purpose:
+	Place phi nodes to dominance frontiers of blocks defining tracked variables.
+	Procedure calls define all tracked variables.
+*/
+{
+	UInt32 b, p, k, n, v, r, cnt, call_cnt, top;
+	UInt32 * df_first, * df_stamp, * def_first, * calls, * last_def, * fill, * work, * has_phi, * in_work;
+	UInt32 * df = NULL, * def_blks = NULL;
+	SsaPhi * phi;
+	Instr * i;
+
+	//=== Dominance frontiers
+	// Block is in the dominance frontier of all blocks on dominator tree path from it's predecessor up to (excluding)
+	// it's immediate dominator. Procedure entry is entered from outside too, so it is join even with single predecessor.
+
+	df_first = (UInt32 *)MemAllocEmpty(sizeof(UInt32) * (ssa->blk_cnt + 1));
+	df_stamp = (UInt32 *)MemAllocEmpty(sizeof(UInt32) * ssa->blk_cnt);
+	fill     = (UInt32 *)MemAlloc(sizeof(UInt32) * ssa->blk_cnt);
+
+	for(r = 0; r < 2; r++) {
+		// First round counts the frontiers, second round fills them
+		if (r == 1) {
+			for(b = 0; b < ssa->blk_cnt; b++) {
+				df_first[b + 1] += df_first[b];
+				fill[b] = df_first[b];
+				df_stamp[b] = 0;
+			}
+			df = (UInt32 *)MemAlloc(sizeof(UInt32) * (df_first[ssa->blk_cnt] + 1));
+		}
+		for(b = 0; b < ssa->blk_cnt; b++) {
+			cnt = ssa->pred_first[b + 1] - ssa->pred_first[b];
+			if (cnt < 2 && !(b == 0 && cnt > 0)) continue;
+			for(k = ssa->pred_first[b]; k < ssa->pred_first[b + 1]; k++) {
+				for(p = ssa->preds[k]; p != ssa->idom[b] && p != SSA_NONE; p = ssa->idom[p]) {
+					if (df_stamp[p] == b + 1) continue;
+					df_stamp[p] = b + 1;
+					if (r == 0) {
+						df_first[p + 1]++;
+					} else {
+						df[fill[p]++] = b;
+					}
+				}
+			}
+		}
+	}
+
+	//=== Blocks defining variables
+
+	def_first = (UInt32 *)MemAllocEmpty(sizeof(UInt32) * (ssa->var_cnt + 1));
+	last_def  = (UInt32 *)MemAlloc(sizeof(UInt32) * (ssa->var_cnt + 1));
+	calls     = (UInt32 *)MemAlloc(sizeof(UInt32) * ssa->blk_cnt);
+	call_cnt = 0;
+
+	for(r = 0; r < 2; r++) {
+		if (r == 1) {
+			for(v = 0; v < ssa->var_cnt; v++) def_first[v + 1] += def_first[v];
+			def_blks = (UInt32 *)MemAlloc(sizeof(UInt32) * (def_first[ssa->var_cnt] + 1));
+			for(v = 0; v < ssa->var_cnt; v++) last_def[v] = def_first[v];
+		}
+		for(v = 0; v < ssa->var_cnt; v++) {
+			if (r == 0) last_def[v] = SSA_NONE;
+		}
+		for(b = 0; b < ssa->blk_cnt; b++) {
+			if (!SsaReachable(ssa, b)) continue;
+			for(n = ssa->instr_first[b]; n < ssa->instr_first[b + 1]; n++) {
+				i = ssa->instrs[n];
+				if (i->op == INSTR_LINE) continue;
+				if (i->op == INSTR_CALL) {
+					if (r == 0 && (call_cnt == 0 || calls[call_cnt - 1] != b)) calls[call_cnt++] = b;
+					continue;
+				}
+				v = SsaVarIndex(ssa, i->result);
+				if (v == SSA_NONE) continue;
+				if (r == 0) {
+					if (last_def[v] != b) {
+						last_def[v] = b;
+						def_first[v + 1]++;
+					}
+				} else {
+					if (last_def[v] == def_first[v] || def_blks[last_def[v] - 1] != b) {
+						def_blks[last_def[v]++] = b;
+					}
+				}
+			}
+		}
+	}
+
+	//=== Phi nodes
+
+	work    = (UInt32 *)MemAlloc(sizeof(UInt32) * ssa->blk_cnt);
+	has_phi = (UInt32 *)MemAllocEmpty(sizeof(UInt32) * ssa->blk_cnt);
+	in_work = (UInt32 *)MemAllocEmpty(sizeof(UInt32) * ssa->blk_cnt);
+
+	for(v = 0; v < ssa->var_cnt; v++) {
+		top = 0;
+		for(k = def_first[v]; k < def_first[v + 1]; k++) {
+			b = def_blks[k];
+			in_work[b] = v + 1;
+			work[top++] = b;
+		}
+		for(k = 0; k < call_cnt; k++) {
+			b = calls[k];
+			if (in_work[b] == v + 1) continue;
+			in_work[b] = v + 1;
+			work[top++] = b;
+		}
+
+		while(top > 0) {
+			b = work[--top];
+			for(k = df_first[b]; k < df_first[b + 1]; k++) {
+				p = df[k];
+				if (has_phi[p] == v + 1) continue;
+				has_phi[p] = v + 1;
+
+				cnt = ssa->pred_first[p + 1] - ssa->pred_first[p];
+				phi = MemArenaAllocStruct(&ssa->arena, SsaPhi);
+				phi->blk = p;
+				phi->result = SsaNewName(ssa, ssa->vars[v], SSA_NONE);
+				phi->args = (SsaName **)MemArenaAlloc(&ssa->arena, sizeof(SsaName *) * (cnt + 1));
+				for(n = 0; n < cnt; n++) phi->args[n] = &ssa->bottom;
+				phi->next = ssa->phis[p];
+				ssa->phis[p] = phi;
+
+				if (in_work[p] != v + 1) {
+					in_work[p] = v + 1;
+					work[top++] = p;
+				}
+			}
+		}
+	}
+
+	MemFree(in_work);
+	MemFree(has_phi);
+	MemFree(work);
+	MemFree(def_blks);
+	MemFree(calls);
+	MemFree(last_def);
+	MemFree(def_first);
+	MemFree(df);
+	MemFree(fill);
+	MemFree(df_stamp);
+	MemFree(df_first);
+}
+
+/*
+Renaming uses undo log of the current names, so the names defined in a block are forgotten
+when all blocks dominated by it have been processed.
+*/
+
+typedef struct {
+	UInt32 cnt, capacity;
+	UInt32 * vars;
+	SsaName ** names;
+} SsaLog;
+
+static void SsaSetName(Ssa * ssa, SsaLog * log, UInt32 v, SsaName * name)
+{
+	if (log->cnt == log->capacity) {
+		log->capacity = log->capacity * 2 + 64;
+		log->vars  = (UInt32 *)realloc(log->vars, sizeof(UInt32) * log->capacity);
+		log->names = (SsaName **)realloc(log->names, sizeof(SsaName *) * log->capacity);
+	}
+	log->vars[log->cnt] = v;
+	log->names[log->cnt] = ssa->cur[v];
+	log->cnt++;
+	ssa->cur[v] = name;
+}
+
+static void SsaRenameBlock(Ssa * ssa, SsaLog * log, UInt32 b)
+{
+	SsaPhi * phi;
+	Instr * i;
+	Var * arg;
+	UInt32 n, k, v, s, sc, slot, succ[2];
+	SsaName * name;
+
+	for(phi = ssa->phis[b]; phi != NULL; phi = phi->next) {
+		SsaSetName(ssa, log, phi->result->var->set_index, phi->result);
+	}
+
+	for(n = ssa->instr_first[b]; n < ssa->instr_first[b + 1]; n++) {
+		i = ssa->instrs[n];
+		if (i->op == INSTR_LINE) continue;
+
+		for(k = 0; k < 2; k++) {
+			arg = (k == 0) ? i->arg1 : i->arg2;
+			v = SsaVarIndex(ssa, arg);
+			if (v != SSA_NONE) {
+				name = ssa->cur[v];
+				ssa->uses[2 * n + k] = name;
+				SsaAddUse(ssa, name, n, NULL);
+			}
+		}
+
+		if (i->op == INSTR_CALL) {
+			for(v = 0; v < ssa->var_cnt; v++) {
+				SsaSetName(ssa, log, v, &ssa->bottom);
+			}
+		} else if (!IS_INSTR_JUMP(i->op)) {
+			v = SsaVarIndex(ssa, i->result);
+			if (v != SSA_NONE) {
+				name = SsaNewName(ssa, i->result, n);
+				ssa->defs[n] = name;
+				SsaSetName(ssa, log, v, name);
+			}
+		}
+	}
+
+	// Fill arguments of phi nodes in successors
+
+	sc = SsaSuccessors(ssa, b, succ);
+	for(k = 0; k < sc; k++) {
+		s = succ[k];
+		slot = SsaPredSlot(ssa, s, b) - ssa->pred_first[s];
+		for(phi = ssa->phis[s]; phi != NULL; phi = phi->next) {
+			name = ssa->cur[phi->result->var->set_index];
+			phi->args[slot] = name;
+			SsaAddUse(ssa, name, SSA_NONE, phi);
+		}
+	}
+}
+
+static void SsaRename(Ssa * ssa)
+/*
+Purpose:
+	Assign SSA names to definitions and uses of tracked variables by walking the dominator tree.
+*/
+{
+	UInt32 b, k, v, sp;
+	UInt32 * dom_first, * dom, * fill, * stack, * mark;
+	SsaLog log;
+
+	// Children in dominator tree
+
+	dom_first = (UInt32 *)MemAllocEmpty(sizeof(UInt32) * (ssa->blk_cnt + 1));
+	dom       = (UInt32 *)MemAlloc(sizeof(UInt32) * ssa->blk_cnt);
+	fill      = (UInt32 *)MemAlloc(sizeof(UInt32) * ssa->blk_cnt);
+	stack     = (UInt32 *)MemAlloc(sizeof(UInt32) * ssa->blk_cnt);
+	mark      = (UInt32 *)MemAlloc(sizeof(UInt32) * ssa->blk_cnt);
+
+	for(b = 0; b < ssa->blk_cnt; b++) {
+		if (ssa->idom[b] != SSA_NONE) dom_first[ssa->idom[b] + 1]++;
+	}
+	for(b = 0; b < ssa->blk_cnt; b++) {
+		dom_first[b + 1] += dom_first[b];
+		fill[b] = dom_first[b];
+	}
+	for(b = 0; b < ssa->blk_cnt; b++) {
+		if (ssa->idom[b] != SSA_NONE) dom[fill[ssa->idom[b]]++] = b;
+	}
+
+	ssa->cur = (SsaName **)MemArenaAlloc(&ssa->arena, sizeof(SsaName *) * (ssa->var_cnt + 1));
+	for(v = 0; v < ssa->var_cnt; v++) ssa->cur[v] = &ssa->bottom;
+
+	log.cnt = log.capacity = 0;
+	log.vars = NULL;
+	log.names = NULL;
+
+	stack[0] = 0; mark[0] = SSA_NONE; sp = 1;
+	while(sp > 0) {
+		b = stack[sp - 1];
+		if (mark[sp - 1] == SSA_NONE) {
+			mark[sp - 1] = log.cnt;
+			SsaRenameBlock(ssa, &log, b);
+			for(k = dom_first[b]; k < dom_first[b + 1]; k++) {
+				stack[sp] = dom[k]; mark[sp] = SSA_NONE; sp++;
+			}
+		} else {
+			while(log.cnt > mark[sp - 1]) {
+				log.cnt--;
+				ssa->cur[log.vars[log.cnt]] = log.names[log.cnt];
+			}
+			sp--;
+		}
+	}
+
+	free(log.vars);
+	free(log.names);
+	MemFree(mark);
+	MemFree(stack);
+	MemFree(fill);
+	MemFree(dom);
+	MemFree(dom_first);
+}
+
+static void SsaBuild(Var * proc, Ssa * ssa)
+/*
+Purpose:
+	Build SSA form of the procedure.
+	Blocks of the procedure must be linked.
+*/
+{
+	MemEmptyVar(*ssa);
+	ssa->proc = proc;
+	ssa->bottom.state = SCCP_BOTTOM;
+	ssa->bottom.def = SSA_NONE;
+
+	MarkLoops(proc);
+
+	SsaBlocks(ssa);
+	SsaVars(ssa);
+	SsaPlacePhis(ssa);
+	SsaRename(ssa);
+}
+
+static void SsaFree(Ssa * ssa)
+{
+	free(ssa->vars);
+	free(ssa->excluded);
+	MemArenaFree(&ssa->arena);
+}
+
+/*
+==================================================
+Optimization: Sparse conditional constant propagation
+==================================================
+
+Every SSA name has lattice value TOP (not executed yet), constant or BOTTOM (not constant).
+Blocks are evaluated only when some edge leading to them has been found executable, and branches with
+constant condition make only one of their edges executable (Wegman, Zadeck).
+When value of name changes, only instructions and phi nodes using it are evaluated again,
+so every name and edge is processed at most twice.
+
+Uses of variables with constant value are replaced by the constant and branches with constant
+condition are replaced by goto or removed. Blocks that are no more reachable are removed by dead code elimination.
+
+This is performed before translation, because after it the conditions are computed using processor flags.
+*/
+
+static SccpState SccpArg(Ssa * ssa, Var * arg, SsaName * name, Var ** p_value)
+{
+	if (name != NULL) {
+		*p_value = name->value;
+		return name->state;
+	}
+	*p_value = arg;
+	if (arg == NULL) return SCCP_CONST;
+	if ((arg->mode == INSTR_INT || arg->mode == INSTR_CONST) && VarIntConst(arg) != NULL) return SCCP_CONST;
+	return SCCP_BOTTOM;
+}
+
+static void SccpSet(Ssa * ssa, SsaName * name, SccpState state, Var * value)
+{
+	if (state < name->state) return;
+	if (state == name->state) {
+		if (state != SCCP_CONST || VarEq(value, name->value)) return;
+		state = SCCP_BOTTOM;
+	}
+	name->state = state;
+	name->value = (state == SCCP_CONST) ? value : NULL;
+	if (!name->queued) {
+		name->queued = true;
+		name->next_work = ssa->name_work;
+		ssa->name_work = name;
+	}
+}
+
+static void SccpEdge(Ssa * ssa, UInt32 from, InstrBlock * to)
+{
+	UInt32 slot;
+	if (to == NULL) return;
+	slot = SsaPredSlot(ssa, to->seq_no - 1, from);
+	if (slot != SSA_NONE && !ssa->exec_edge[slot]) {
+		ssa->exec_edge[slot] = true;
+		ssa->edge_work[ssa->edge_tail++] = slot;
+	}
+}
+
+static SccpState SccpCondition(Ssa * ssa, UInt32 n, Bool * p_taken)
+/*
+Purpose:
+	Evaluate condition of branch instruction.
+*/
+{
+	Instr * i = ssa->instrs[n];
+	SccpState s1, s2;
+	Var * v1, * v2;
+	BigInt * l, * r;
+
+	if (i->op < INSTR_IFEQ || i->op > INSTR_IFLE) return SCCP_BOTTOM;
+
+	s1 = SccpArg(ssa, i->arg1, ssa->uses[2 * n], &v1);
+	s2 = SccpArg(ssa, i->arg2, ssa->uses[2 * n + 1], &v2);
+	// TOP arguments have no value yet, so they must be tested before the value is used
+	if (s1 == SCCP_BOTTOM || s2 == SCCP_BOTTOM) return SCCP_BOTTOM;
+	if (s1 == SCCP_TOP || s2 == SCCP_TOP) return SCCP_TOP;
+	if (v1 == NULL || v2 == NULL) return SCCP_BOTTOM;
+
+	l = VarIntConst(v1);
+	r = VarIntConst(v2);
+	switch(i->op) {
+	case INSTR_IFEQ: *p_taken = IntEq(l, r); break;
+	case INSTR_IFNE: *p_taken = !IntEq(l, r); break;
+	case INSTR_IFLT: *p_taken = IntLower(l, r); break;
+	case INSTR_IFGE: *p_taken = IntHigherEq(l, r); break;
+	case INSTR_IFGT: *p_taken = IntHigher(l, r); break;
+	case INSTR_IFLE: *p_taken = IntLowerEq(l, r); break;
+	default: return SCCP_BOTTOM;
+	}
+	return SCCP_CONST;
+}
+
+static void SccpExits(Ssa * ssa, UInt32 b)
+/*
+Purpose:
+	Mark edges leaving executable block, which may be executed.
+*/
+{
+	InstrBlock * blk = ssa->blks[b];
+	Instr * i = blk->last;
+	SccpState state;
+	Bool taken;
+
+	if (i != NULL && IS_INSTR_BRANCH(i->op) && blk->cond_to != NULL && blk->cond_to != blk->to) {
+		state = SccpCondition(ssa, ssa->instr_first[b + 1] - 1, &taken);
+		if (state == SCCP_TOP) return;
+		if (state == SCCP_CONST) {
+			SccpEdge(ssa, b, taken ? blk->cond_to : blk->to);
+			return;
+		}
+	}
+	SccpEdge(ssa, b, blk->to);
+	SccpEdge(ssa, b, blk->cond_to);
+}
+
+static Var * SccpFold(InstrOp op, Var * v1, Var * v2)
+{
+	switch(op) {
+	case INSTR_DIV:
+	case INSTR_MOD:
+		if (IntEqN(VarIntConst(v1), 0) || IntEqN(VarIntConst(v2), 0)) return NULL;
+	case INSTR_ADD:
+	case INSTR_SUB:
+	case INSTR_MUL:
+	case INSTR_AND:
+	case INSTR_OR:
+	case INSTR_XOR:
+	case INSTR_LO:
+	case INSTR_HI:
+		return InstrEvalConst(op, v1, v2);
+	default:
+		return NULL;
+	}
+}
+
+static void SccpInstr(Ssa * ssa, UInt32 n)
+/*
+Purpose:
+	Evaluate instruction in executable block.
+*/
+{
+	Instr * i = ssa->instrs[n];
+	SsaName * name;
+	SccpState state, s2;
+	Var * value, * v2;
+	Type * type;
+	BigInt * c;
+
+	if (i == ssa->blks[ssa->instr_blk[n]]->last && IS_INSTR_BRANCH(i->op)) {
+		SccpExits(ssa, ssa->instr_blk[n]);
+		return;
+	}
+
+	name = ssa->defs[n];
+	if (name == NULL) return;
+
+	if (i->op == INSTR_LET) {
+		state = SccpArg(ssa, i->arg1, ssa->uses[2 * n], &value);
+	} else {
+		state = SccpArg(ssa, i->arg1, ssa->uses[2 * n], &value);
+		s2    = SccpArg(ssa, i->arg2, ssa->uses[2 * n + 1], &v2);
+		if (state == SCCP_BOTTOM || s2 == SCCP_BOTTOM) {
+			state = SCCP_BOTTOM;
+		} else if (state == SCCP_TOP || s2 == SCCP_TOP) {
+			state = SCCP_TOP;
+		} else {
+			if (value != NULL) value = SccpFold(i->op, value, v2);
+			if (value == NULL) state = SCCP_BOTTOM;
+		}
+	}
+
+	// Value, which does not fit into the type of variable, would be wrapped when computed by processor
+	if (state == SCCP_CONST) {
+		c = VarIntConst(value);
+		type = name->var->type;
+		if (c == NULL) {
+			state = SCCP_BOTTOM;
+		} else if (type != NULL && type->variant == TYPE_INT) {
+			if (IntLower(c, &type->range.min) || IntHigher(c, &type->range.max)) state = SCCP_BOTTOM;
+		}
+	}
+
+	SccpSet(ssa, name, state, value);
+}
+
+static void SccpPhi(Ssa * ssa, SsaPhi * phi)
+{
+	UInt32 k, first;
+	SccpState state = SCCP_TOP;
+	Var * value = NULL;
+	SsaName * arg;
+
+	// Procedure entry is entered from outside with unknown values too
+	if (phi->blk == 0) {
+		SccpSet(ssa, phi->result, SCCP_BOTTOM, NULL);
+		return;
+	}
+
+	first = ssa->pred_first[phi->blk];
+	for(k = first; k < ssa->pred_first[phi->blk + 1]; k++) {
+		if (!ssa->exec_edge[k]) continue;
+		arg = phi->args[k - first];
+		if (arg->state == SCCP_TOP) continue;
+		if (state == SCCP_TOP) {
+			state = arg->state;
+			value = arg->value;
+		} else if (state == SCCP_CONST && (arg->state != SCCP_CONST || !VarEq(value, arg->value))) {
+			state = SCCP_BOTTOM;
+		}
+	}
+	SccpSet(ssa, phi->result, state, value);
+}
+
+static void SccpVisitBlock(Ssa * ssa, UInt32 b)
+{
+	SsaPhi * phi;
+	UInt32 n;
+
+	ssa->exec_blk[b] = true;
+	for(phi = ssa->phis[b]; phi != NULL; phi = phi->next) SccpPhi(ssa, phi);
+	for(n = ssa->instr_first[b]; n < ssa->instr_first[b + 1]; n++) {
+		if (ssa->instrs[n]->op != INSTR_LINE) SccpInstr(ssa, n);
+	}
+	SccpExits(ssa, b);
+}
+
+static void Sccp(Ssa * ssa)
+{
+	UInt32 b, slot;
+	SsaName * name;
+	SsaUse * use;
+	SsaPhi * phi;
+
+	ssa->exec_blk  = (Bool *)MemArenaAllocEmpty(&ssa->arena, sizeof(Bool) * ssa->blk_cnt);
+	ssa->exec_edge = (Bool *)MemArenaAllocEmpty(&ssa->arena, sizeof(Bool) * (ssa->pred_first[ssa->blk_cnt] + 1));
+	ssa->edge_work = (UInt32 *)MemArenaAlloc(&ssa->arena, sizeof(UInt32) * (ssa->pred_first[ssa->blk_cnt] + 1));
+	ssa->edge_blk  = (UInt32 *)MemArenaAlloc(&ssa->arena, sizeof(UInt32) * (ssa->pred_first[ssa->blk_cnt] + 1));
+	for(b = 0; b < ssa->blk_cnt; b++) {
+		for(slot = ssa->pred_first[b]; slot < ssa->pred_first[b + 1]; slot++) ssa->edge_blk[slot] = b;
+	}
+	ssa->edge_head = ssa->edge_tail = 0;
+	ssa->name_work = NULL;
+
+	SccpVisitBlock(ssa, 0);
+
+	while(true) {
+		if (ssa->edge_head < ssa->edge_tail) {
+			slot = ssa->edge_work[ssa->edge_head++];
+			b = ssa->edge_blk[slot];
+			if (ssa->exec_blk[b]) {
+				for(phi = ssa->phis[b]; phi != NULL; phi = phi->next) SccpPhi(ssa, phi);
+			} else {
+				SccpVisitBlock(ssa, b);
+			}
+		} else if (ssa->name_work != NULL) {
+			name = ssa->name_work;
+			ssa->name_work = name->next_work;
+			name->queued = false;
+			for(use = name->uses; use != NULL; use = use->next) {
+				if (use->phi != NULL) {
+					if (ssa->exec_blk[use->phi->blk]) SccpPhi(ssa, use->phi);
+				} else {
+					if (ssa->exec_blk[ssa->instr_blk[use->instr]]) SccpInstr(ssa, use->instr);
+				}
+			}
+		} else {
+			break;
+		}
+	}
+}
+
+static Bool SccpReplaces(InstrOp op)
+{
+	switch(op) {
+	case INSTR_LET:
+	case INSTR_ADD:
+	case INSTR_SUB:
+	case INSTR_MUL:
+	case INSTR_DIV:
+	case INSTR_MOD:
+	case INSTR_AND:
+	case INSTR_OR:
+	case INSTR_XOR:
+	case INSTR_LO:
+	case INSTR_HI:
+	case INSTR_IFEQ:
+	case INSTR_IFNE:
+	case INSTR_IFLT:
+	case INSTR_IFGE:
+	case INSTR_IFGT:
+	case INSTR_IFLE:
+		return true;
+	default:
+		return false;
+	}
+}
+
+void OptimizeConstProp(Var * proc)
+/*
+Purpose:
+	Propagate constants through the procedure and remove branches, whose condition is constant.
+*/
+{
+	Ssa ssa;
+	UInt32 b, n;
+	InstrBlock * blk;
+	Instr * i;
+	SsaName * name;
+	Bool modified = false, modified_blocks = false, taken;
+
+	if (proc->instr == NULL) return;
+
+	LinkBlocks(proc);
+	SsaBuild(proc, &ssa);
+	Sccp(&ssa);
+
+	for(b = 0; b < ssa.blk_cnt; b++) {
+		if (!ssa.exec_blk[b]) continue;
+		blk = ssa.blks[b];
+		for(n = ssa.instr_first[b]; n < ssa.instr_first[b + 1]; n++) {
+			i = ssa.instrs[n];
+			if (!SccpReplaces(i->op)) continue;
+
+			if (i == blk->last && IS_INSTR_BRANCH(i->op) && blk->cond_to != NULL && blk->cond_to != blk->to) {
+				if (SccpCondition(&ssa, n, &taken) == SCCP_CONST) {
+					if (taken) {
+						i->op = INSTR_GOTO;
+						i->arg1 = i->arg2 = NULL;
+					} else {
+						i->result->write--;
+						InstrDelete(blk, i);
+					}
+					modified_blocks = true;
+					break;
+				}
+			}
+
+			// Read counts are not changed, variable is still read in the source code
+			name = ssa.uses[2 * n];
+			if (name != NULL && name->state == SCCP_CONST) {
+				i->arg1 = name->value;
+				modified = true;
+			}
+			name = ssa.uses[2 * n + 1];
+			if (name != NULL && name->state == SCCP_CONST) {
+				i->arg2 = name->value;
+				modified = true;
+			}
+		}
+	}
+
+	SsaFree(&ssa);
+
+	if (modified_blocks) {
+		GenerateBasicBlocks(proc);
+		DeadCodeElimination(proc);
+	}
+
+	if ((modified || modified_blocks) && Verbose(proc)) {
+		PrintHeader(3, "Constant propagation");
+		PrintProc(proc);
+	}
+}
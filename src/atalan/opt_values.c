@@ -15,6 +15,22 @@ Licensed under the MIT license: http://www.opensource.org/licenses/mit-license.p
 
 #include "language.h"
 
+GLOBAL MemArena EXP_ARENA;		// expressions (dependency trees) of currently optimized procedure
+
+// Value table used to share expressions (hash consing).
+// Expressions are released together with EXP_ARENA, so the table is cleared by ExpCleanup.
+
+#define EXP_HASH_SIZE 1024
+static Exp * EXP_HASH[EXP_HASH_SIZE];
+static UInt32 EXP_VN;
+
+// Variables, that may have src_i or dep set (they have VarValueKnown flag).
+// When some value changes, only these variables must be checked, not all variables in the program.
+
+static Var ** VALUE_VARS;
+static UInt32 VALUE_VAR_CNT;
+static UInt32 VALUE_VAR_CAPACITY;
+
 void PrintExp(Exp * exp);
 
 void ExpFree(Exp ** p_exp)
@@ -167,13 +183,72 @@ Purpose:
 	return result;
 }
 
+static void ValueVarAdd(Var * var)
+/*
+Purpose:
+	Register the variable as having known value (src_i or dep).
+*/
+{
+	UInt32 new_capacity;
+
+	if (FlagOn(var->flags, VarValueKnown)) return;
+
+	if (VALUE_VAR_CNT == VALUE_VAR_CAPACITY) {
+		new_capacity = VALUE_VAR_CAPACITY * 2;
+		if (new_capacity == 0) new_capacity = 64;
+		VALUE_VARS = (Var **)realloc(VALUE_VARS, sizeof(Var *) * new_capacity);
+		VALUE_VAR_CAPACITY = new_capacity;
+	}
+	VALUE_VARS[VALUE_VAR_CNT++] = var;
+	SetFlagOn(var->flags, VarValueKnown);
+}
+
+static void ForgetValues()
+/*
+Purpose:
+	Forget all known values.
+	Only variables registered using ValueVarAdd are reset.
+*/
+{
+	Var * var;
+	UInt32 n;
+
+	for(n = 0; n < VALUE_VAR_CNT; n++) {
+		var = VALUE_VARS[n];
+		var->src_i = NULL;
+		ExpFree(&var->dep);
+		SetFlagOff(var->flags, VarValueKnown);
+	}
+	VALUE_VAR_CNT = 0;
+}
+
 void ResetValues()
+/*
+Purpose:
+	Reset values of all variables.
+	Other optimizations (for example OptimizeLive) use src_i for their own purposes, 
+	so this sweeps all variables, not only variables with known value.
+*/
 {
 	Var * var;
 	FOR_EACH_VAR(var)
 		var->src_i       = NULL;
-		ExpFree(&var->dep);		// TODO: Release the expression objects
+		ExpFree(&var->dep);		// expression objects are released by ExpCleanup
+		SetFlagOff(var->flags, VarValueKnown);
 	NEXT_VAR
+	VALUE_VAR_CNT = 0;
+}
+
+void ExpCleanup()
+/*
+Purpose:
+	Release all expression objects created while optimizing procedure.
+*/
+{
+	ResetValues();
+	MemArenaReset(&EXP_ARENA);
+	MemEmpty(EXP_HASH, sizeof(EXP_HASH));
+	EXP_VN = 0;
 }
 
 void ResetValue(Var * res)
@@ -185,9 +260,11 @@ Purpose:
 {
 	Var * var;
 	Instr * i;
+	UInt32 n;
 	if (res == NULL) return;
 
-	FOR_EACH_VAR(var)
+	for(n = 0; n < VALUE_VAR_CNT; n++) {
+		var = VALUE_VARS[n];
 		if (!VarIsConst(var)) {
 //			if (var->name != NULL && StrEqual(var->name, "a")) {
 //				i = NULL;
@@ -233,7 +310,7 @@ Purpose:
 				}
 			}
 		}
-	NEXT_VAR
+	}
 
 	// If value is alias to some other value, reset it too
 	//TODO: How about element (non constant, let's say?)
@@ -268,12 +345,14 @@ Purpose:
 void ResetVarDepRoot(Var * res)
 {
 	Var * var;
+	UInt32 n;
 
-	FOR_EACH_VAR(var)
-		if (VarIsAlias(var, res)) {
+	for(n = 0; n < VALUE_VAR_CNT; n++) {
+		var = VALUE_VARS[n];
+		if (var->dep != NULL && VarIsAlias(var, res)) {
 			ExpFree(&var->dep);
 		}
-	NEXT_VAR
+	}
 }
 
 void ResetVarDep(Var * res)
@@ -285,8 +364,10 @@ Purpose:
 {
 	Var * var;
 	Exp * exp;
+	UInt32 n;
 
-	FOR_EACH_VAR(var)
+	for(n = 0; n < VALUE_VAR_CNT; n++) {
+		var = VALUE_VARS[n];
 
 //		if (var->adr != NULL && StrEqual(var->adr->name, "_arr")) {
 //			Print("");
@@ -305,7 +386,7 @@ Purpose:
 				}
 			}
 //		}
-	NEXT_VAR
+	}
 
 	// If the variable is alias for some other variable,
 	// reset aliased variable too
@@ -327,55 +408,112 @@ Purpose:
   Expressions
 **********************************/
 
-Exp * ExpAlloc(InstrOp op)
+static Exp * ExpAlloc(InstrOp op)
 {
-	Exp * exp = MemAllocStruct(Exp);
+	Exp * exp = MemArenaAllocStruct(&EXP_ARENA, Exp);
 	exp->op = op;
+	exp->vn = ++EXP_VN;
+	return exp;
+}
+
+static Bool ExpIsConst(Exp * exp)
+{
+	return exp->op == INSTR_VAR && exp->var->mode == INSTR_INT;
+}
+
+Exp * ExpNew(InstrOp op, Exp * arg1, Exp * arg2)
+/*
+Purpose:
+	Return expression computing op(arg1, arg2).
+	If such expression already exists, it is returned, so equal expressions have same value number.
+	Arguments of commutative operations are normalized (constant is always second, other arguments
+	are ordered by value number), so a+b and b+a is the same expression.
+*/
+{
+	Exp * exp, * t;
+	UInt32 h;
+
+	if (arg1 != NULL && arg2 != NULL && FlagOn(INSTR_INFO[op].flags, INSTR_COMMUTATIVE)) {
+		if (ExpIsConst(arg1) != ExpIsConst(arg2) ? ExpIsConst(arg1) : arg1->vn > arg2->vn) {
+			t = arg1; arg1 = arg2; arg2 = t;
+		}
+	}
+
+	h = (op * 31 + (arg1 != NULL ? arg1->vn : 0)) * 31 + (arg2 != NULL ? arg2->vn : 0);
+	h = h % EXP_HASH_SIZE;
+
+	for(exp = EXP_HASH[h]; exp != NULL; exp = exp->next_hash) {
+		if (exp->op == op && exp->arg[0] == arg1 && exp->arg[1] == arg2) return exp;
+	}
+
+	exp = ExpAlloc(op);
+	exp->arg[0] = arg1;
+	exp->arg[1] = arg2;
+	exp->next_hash = EXP_HASH[h];
+	EXP_HASH[h] = exp;
+	return exp;
+}
+
+Exp * ExpVar(Var * var)
+/*
+Purpose:
+	Return expression representing value of the variable.
+	Input variables may change their value at any time, so every reference to them is a different expression.
+*/
+{
+	Exp * exp;
+	UInt32 h;
+
+	if (FlagOn(var->submode, SUBMODE_IN)) {
+		exp = ExpAlloc(INSTR_VAR);
+		exp->var = var;
+		return exp;
+	}
+
+	h = (UInt32)(((size_t)var / sizeof(Var)) % EXP_HASH_SIZE);
+	for(exp = EXP_HASH[h]; exp != NULL; exp = exp->next_hash) {
+		if (exp->op == INSTR_VAR && exp->var == var) return exp;
+	}
+
+	exp = ExpAlloc(INSTR_VAR);
+	exp->var = var;
+	exp->next_hash = EXP_HASH[h];
+	EXP_HASH[h] = exp;
 	return exp;
 }
 
-void ExpArg(Exp * exp, UInt8 arg_idx, Var * arg)
+Exp * ExpArg(Var * arg)
 /*
 Purpose:
-	Specify argument for expression.
+	Return expression used as argument of other expression.
 	If the argument has assigned dependency expression, it is used as dependency.
 	If it has no dependency argument, source (INSTR_LET) dependency is created.
 */
 {
 	Exp * src_dep;
 
-	if (arg != NULL) {
+	if (arg == NULL) return NULL;
 
-		src_dep = arg->dep;
+	src_dep = arg->dep;
 
-		if (arg->mode == INSTR_DEREF) {
-			src_dep = ExpAlloc(INSTR_DEREF);
-			ExpArg(src_dep, 0, arg->var);
-		} else if (VarIsArrayElement(arg) || arg->mode == INSTR_BYTE) {
-			//TODO: Support for 2d arrays
-			//      In assembler phase is not required (we do not have instructions for 2d indexed arrays).
-			if (arg->var->mode != INSTR_INT) {
-				src_dep = ExpAlloc(arg->mode);
-				ExpArg(src_dep, 0, arg->adr);
-				ExpArg(src_dep, 1, arg->var);
-			}
-		} else if (arg->mode == INSTR_TUPLE) {
-			src_dep = ExpAlloc(arg->mode);
-			ExpArg(src_dep, 0, arg->adr);
-			ExpArg(src_dep, 1, arg->var);
-		} else if (arg->mode == INSTR_VAR && arg->adr != NULL && arg->adr->mode == INSTR_TUPLE) {
-			ExpArg(exp, arg_idx, arg->adr);
-			return;
+	if (arg->mode == INSTR_DEREF) {
+		src_dep = ExpNew(INSTR_DEREF, ExpArg(arg->var), NULL);
+	} else if (VarIsArrayElement(arg) || arg->mode == INSTR_BYTE) {
+		//TODO: Support for 2d arrays
+		//      In assembler phase is not required (we do not have instructions for 2d indexed arrays).
+		if (arg->var->mode != INSTR_INT) {
+			src_dep = ExpNew(arg->mode, ExpArg(arg->adr), ExpArg(arg->var));
 		}
+	} else if (arg->mode == INSTR_TUPLE) {
+		src_dep = ExpNew(arg->mode, ExpArg(arg->adr), ExpArg(arg->var));
+	} else if (arg->mode == INSTR_VAR && arg->adr != NULL && arg->adr->mode == INSTR_TUPLE) {
+		return ExpArg(arg->adr);
+	}
 
-		if (src_dep != NULL) {
-			exp->arg[arg_idx] = src_dep;
-		} else {
-			src_dep = ExpAlloc(INSTR_VAR);
-			src_dep->var = arg;
-			exp->arg[arg_idx] = src_dep;
-		}
+	if (src_dep == NULL) {
+		src_dep = ExpVar(arg);
 	}
+	return src_dep;
 }
 
 void PrintExp(Exp * exp)
@@ -426,29 +564,16 @@ Purpose:
 
 	if (op == INSTR_LET) {
 		if ((VarIsArrayElement(arg) || arg->mode == INSTR_BYTE) && arg->var->mode != INSTR_INT) {
-			exp = ExpAlloc(arg->mode);
-			ExpArg(exp, 0, arg->adr);
-			ExpArg(exp, 1, arg->var);
+			exp = ExpNew(arg->mode, ExpArg(arg->adr), ExpArg(arg->var));
+		} else if (arg->dep != NULL) {
+			exp = arg->dep;
 		} else {
-			if (arg->dep != NULL) {
-				if (op == INSTR_VAR) {
-					arg = arg->dep->var;
-				} else {
-					exp = arg->dep;
-					goto done;
-				}
-			}
-			exp = ExpAlloc(INSTR_VAR);
-			exp->var = arg;
+			exp = ExpVar(arg);
 		}
 	} else {
-		exp = ExpAlloc(op);
 		//todo: kill dependency, if source variables are not equal to result
-
-		ExpArg(exp, 0, i->arg1);
-		ExpArg(exp, 1, i->arg2);
+		exp = ExpNew(op, ExpArg(i->arg1), ExpArg(i->arg2));
 	}
-done:
 	return exp;
 }
 
@@ -456,6 +581,8 @@ void SetDependency(Var * var, Exp * exp)
 {	
 	if (var == NULL) return;
 
+	if (exp != NULL) ValueVarAdd(var);
+
 	// If we are setting value of some expression to tuple, separate elements of that tuple are reset.
 	// Whole tuple however receives the dependency on the expression.
 
@@ -487,9 +614,7 @@ void Dependency(Instr * i)
 	// This may happen, when some self-reference expression is calculated.
 
 	if (i->op == INSTR_LET && i->arg1->dep == NULL && i->arg1->mode != INSTR_INT) {
-		exp = ExpAlloc(INSTR_VAR);
-		exp->var = i->result;
-		SetDependency(i->arg1, exp);
+		SetDependency(i->arg1, ExpVar(i->result));
 	}
 
 /*
@@ -556,10 +681,17 @@ Bool ExpEquivalentInstr(Exp * exp, Instr * i)
 }
 
 Bool CodeModifiesVar(Instr * from, Instr * to, Var * var)
+/*
+Purpose:
+	Test, whether code between the two instructions modifies the variable.
+	If the instruction 'to' is not in the same block as 'from', we can not tell, so we return true.
+*/
 {
 	Instr * i;
 	Var * result;
-	for(i = from; i != NULL && i != to; i = i->next) {
+	if (from == to) return false;
+	for(i = from; i != to; i = i->next) {
+		if (i == NULL) return true;
 		if (i->op != INSTR_LINE) {
 			result = i->result;
 			if (result != NULL)  {
@@ -721,6 +853,7 @@ void VarSetSrcInstr(Var * var, Instr * i)
 	if (var->mode == INSTR_INT) return;
 
 	var->src_i = i;
+	if (i != NULL) ValueVarAdd(var);
 	if (var->mode == INSTR_TUPLE) {
 		VarSetSrcInstr(var->adr, i);
 		VarSetSrcInstr(var->var, i);
@@ -750,11 +883,15 @@ void TransformInstrRule(Loc * loc, Rule * rule, Var * result, Var * arg1, Var *
 		old_color = PrintColor(GREEN+LIGHT);
 		PrintFmt("%ld#%ld %s:", loc->blk->seq_no, loc->n, message); InstrPrintInline(i);
 	}
+	if (VAR_USE_VALID) InstrUseAdd(i, -1);
 	i->op = rule->op;
 	i->result = result;
 	i->arg1 = arg1;
 	i->arg2 = arg2;
 	i->rule = rule;
+	INSTR_CHANGE_CNT++;
+	if (VAR_USE_VALID) InstrUseAdd(i, 1);
+	InstrBlockChanged(loc->blk);
 	if (Verbose(loc->proc)) {
 		Print(" => "); InstrPrint(i);
 		PrintColor(old_color);
@@ -776,15 +913,30 @@ Bool TransformInstrIfCheaper(Loc * loc, InstrOp op, Var * result, Var * arg1, Va
 {
 	Rule * rule;
 	rule = InstrRule2(op, result, arg1, arg2);
-	// We transform the instruction only it the alternative instruction exists and the new instruction if faster.
-	// We also perform the transformation, if the speed is same (we suppose the instruction may be shorter)
-	if (rule != NULL && rule->cycles <= loc->i->rule->cycles) {
+	// We transform the instruction only it the alternative instruction exists and the new instruction is cheaper.
+	// We also perform the transformation, if the cost is same (we suppose the instruction may be shorter)
+	if (rule != NULL && RuleCost(rule, loc->blk->loop_depth) <= RuleCost(loc->i->rule, loc->blk->loop_depth)) {
 		TransformInstrRule(loc, rule, result, arg1, arg2, message);
 		return true;
 	}
 	return false;
 }
 
+static Bool BlockContinues(InstrBlock * prev, InstrBlock * blk)
+/*
+Purpose:
+	Return true, if the block may be entered only from the end of the previous block.
+	Values known at the end of the previous block are valid at the beginning of the block too.
+	This is true for the block after conditional jump (blocks without label can not be jumped to).
+*/
+{
+	InstrOp op;
+	if (prev == NULL || blk->label != NULL) return false;
+	op = INSTR_VOID;
+	if (prev->last != NULL) op = prev->last->op;
+	return op != INSTR_GOTO && op != INSTR_ASSERT;
+}
+
 Bool OptimizeValues(Var * proc)
 /*
    1. If assigning some value to variable (let) and the variable already contains such value, remove the let instruction
@@ -796,13 +948,16 @@ Bool OptimizeValues(Var * proc)
    2. Copy propagation a <- b where b <- c  to a <- c
 
    3. Constant folding (Evaluate constant instructions)
+
+   Values are carried over from the block to the next block, if it can be entered only from the previous block.
+   Expressions are shared, so equal expressions are detected by comparing their value numbers.
 */
 {
-	Bool modified, m2, m3;
+	Bool modified, m2, m3, carry, dirty;
 	Instr * i, * src_i;
 //	UInt32 n;
 	Var * r, * result, * arg1, * arg2, * r2;
-	InstrBlock * blk;
+	InstrBlock * blk, * prev, * head;
 	InstrOp op, src_op;
 	char buf[32];
 	BigInt diff;
@@ -814,19 +969,43 @@ Bool OptimizeValues(Var * proc)
 
 	loc.proc = proc;
 
+	MarkLoops(proc);
+
 	if (Verbose(proc)) {
 		PrintHeader(3, "optimize values");
 		PrintProc(proc);
 	}
 
-	VarUse();
+	VarUseUpdate();
 
 	modified = false;
 
-	for(blk = proc->instr; blk != NULL; blk = blk->next) {
+	// Values are computed for every chain of blocks separately, so only chains with modified block must be processed again.
+	MarkDirtyBlocks(proc, false);
+
+	for(head = proc->instr; head != NULL; head = blk) {
+		dirty = false;
+		for(blk = head, prev = NULL; blk != NULL && (prev == NULL || BlockContinues(prev, blk)); prev = blk, blk = blk->next) {
+			if (blk->dirty) dirty = true;
+		}
+		for(blk = head, prev = NULL; blk != NULL && (prev == NULL || BlockContinues(prev, blk)); prev = blk, blk = blk->next) {
+			blk->dirty = dirty;
+		}
+	}
+
+	ResetValues();
+	carry = false;
+
+	for(blk = proc->instr, prev = NULL; blk != NULL; prev = blk, blk = blk->next) {
+		if (!blk->dirty) {
+			carry = false;
+			continue;
+		}
 		loc.blk = blk;
 
-		ResetValues();
+		if (!carry || !BlockContinues(prev, blk)) {
+			ForgetValues();
+		}
 		loc.n = 0;
 		for(i = blk->first; i != NULL; i = i->next) {
 retry:
@@ -1086,7 +1265,10 @@ retry:
 				}
 			}
 		}
+		// When some instruction has been replaced, we did not process the rest of the block.
+		carry = (i == NULL);
 	} // block
+	ForgetValues();
 	return modified;
 }
 
@@ -1103,8 +1285,9 @@ Purpose:
 	InstrOp op;
 
 	VarUse();
+	ResetValues();
 	for(blk = proc->instr; blk != NULL; blk = blk->next) {
-		ResetValues();
+		ForgetValues();
 		n = 1;
 		for(i = blk->first; i != NULL; i = i->next, n++) {
 
@@ -1178,6 +1361,7 @@ Purpose:
 
 				if (i->op == INSTR_LET) {
 					result->src_i = i;
+					ValueVarAdd(result);
 				}
 			}
 		}
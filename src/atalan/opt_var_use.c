@@ -50,11 +50,135 @@ done:
 	return calls;
 }
 
+/*
+Interference graph
+==================
+
+Variables are nodes of the graph, identified by their index in the set of allocated variables.
+Two variables are connected by an edge (they collide), if they are live at the same moment, so they can not
+use the same memory. Variable is connected to itself, if it is live at some moment.
+
+Graph is sparse, every node has list of adjacent nodes. Edges are also stored in hash table,
+so the test, whether two variables collide, takes constant time.
+*/
+
+typedef struct {
+	UInt32 * adj;			// indexes of adjacent nodes
+	UInt32   degree;		// number of adjacent nodes
+	UInt32   capacity;		// capacity of adj array
+} GraphNode;
+
+typedef struct {
+	GraphNode * nodes;
+	UInt64 *    edges;		// open addressing hash table of edges (0 means empty slot)
+	UInt32      edge_count;
+	UInt32      edge_size;	// number of slots in edge table (always power of two)
+	MemArena *  arena;		// memory for nodes and adjacency lists
+} Graph;
+
+#define GRAPH_EDGES_INITIAL_SIZE 256
+
+static UInt64 GraphEdgeKey(UInt32 a, UInt32 b)
+{
+	UInt32 t;
+	if (a > b) { t = a; a = b; b = t; }
+	return ((UInt64)(a + 1) << 32) | b;
+}
+
+static UInt32 GraphEdgeHash(UInt64 key)
+{
+	return (UInt32)((key * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+static void GraphInit(Graph * g, UInt32 count, MemArena * arena)
+{
+	g->arena = arena;
+	g->nodes = (GraphNode *)MemArenaAllocEmpty(arena, sizeof(GraphNode) * (count == 0 ? 1 : count));
+	g->edge_count = 0;
+	g->edge_size = GRAPH_EDGES_INITIAL_SIZE;
+	g->edges = (UInt64 *)MemAllocEmpty(sizeof(UInt64) * g->edge_size);
+}
+
+static void GraphCleanup(Graph * g)
+{
+	MemFree(g->edges);
+	g->edges = NULL;
+}
+
+static Bool GraphFindEdge(Graph * g, UInt64 key, UInt32 * p_slot)
+{
+	UInt32 mask, h;
+	mask = g->edge_size - 1;
+	for(h = GraphEdgeHash(key) & mask; g->edges[h] != 0; h = (h + 1) & mask) {
+		if (g->edges[h] == key) {
+			*p_slot = h;
+			return true;
+		}
+	}
+	*p_slot = h;
+	return false;
+}
+
+static Bool GraphHasEdge(Graph * g, UInt32 a, UInt32 b)
+{
+	UInt32 slot;
+	return GraphFindEdge(g, GraphEdgeKey(a, b), &slot);
+}
+
+static void GraphResizeEdges(Graph * g, UInt32 size)
+{
+	UInt64 * old;
+	UInt32 old_size, i, slot;
+
+	old = g->edges;
+	old_size = g->edge_size;
+	g->edges = (UInt64 *)MemAllocEmpty(sizeof(UInt64) * size);
+	g->edge_size = size;
+	for(i = 0; i < old_size; i++) {
+		if (old[i] != 0) {
+			GraphFindEdge(g, old[i], &slot);
+			g->edges[slot] = old[i];
+		}
+	}
+	MemFree(old);
+}
+
+static void GraphAddAdjacent(Graph * g, UInt32 a, UInt32 b)
+{
+	GraphNode * node = &g->nodes[a];
+	UInt32 * adj;
+	if (node->degree == node->capacity) {
+		node->capacity = (node->capacity == 0) ? 4 : node->capacity * 2;
+		adj = (UInt32 *)MemArenaAlloc(g->arena, sizeof(UInt32) * node->capacity);
+		if (node->degree > 0) MemMove(adj, node->adj, sizeof(UInt32) * node->degree);
+		node->adj = adj;
+	}
+	node->adj[node->degree++] = b;
+}
+
+static void GraphAddEdge(Graph * g, UInt32 a, UInt32 b)
+{
+	UInt64 key;
+	UInt32 slot;
+
+	key = GraphEdgeKey(a, b);
+	if (GraphFindEdge(g, key, &slot)) return;
+
+	g->edges[slot] = key;
+	g->edge_count++;
+	GraphAddAdjacent(g, a, b);
+	if (a != b) GraphAddAdjacent(g, b, a);
+
+	// Edge table is kept at most half full
+	if (g->edge_count * 2 > g->edge_size) GraphResizeEdges(g, g->edge_size * 2);
+}
+
 typedef struct
 {
 	VarSet vars;
-	UInt8 * collisions;			// 2D array of collisions of local_variables
+	Graph collisions;			// graph of collisions of local variables
 	LiveSet last_block;
+	MemArena arena;				// memory for analysis data (released at once when the allocation is finished)
 } VarAllocInfo;
 
 
@@ -63,39 +187,51 @@ Bool BlockIsLast(InstrBlock * blk)
 	return (blk->to == NULL || blk->to == blk) && (blk->cond_to == NULL || blk->cond_to == blk);
 }
 
-LiveSet MergeLiveSets(InstrBlock * blk, UInt16 count, LiveSet last_block)
+LiveSet MergeLiveSets(InstrBlock * blk, UInt32 count, LiveSet last_block, MemArena * arena)
 {
-	UInt16 i;
-	LiveSet src_live;
-	LiveSet live = (LiveSet)MemAllocEmpty(count);
+	LiveSet live = LiveSetAlloc(arena, count);
 
 	// For the last block, begin with of last block info
 	if (BlockIsLast(blk)) {
-		MemMove(live, last_block, count);
+		LiveSetCopy(live, last_block, count);
 	// For non-last block, use union of to and cond_to block results
+	// Block, that has not been processed yet, has no live variables.
 	} else {
-		if (blk->to != NULL) {
-			MemMove(live, blk->to->analysis_data, count);
+		if (blk->to != NULL && blk->to->analysis_data != NULL) {
+			LiveSetUnion(live, (LiveSet)blk->to->analysis_data, count);
 		}
-		if (blk->cond_to != NULL && blk->cond_to != blk) {
-			src_live = (LiveSet)blk->cond_to->analysis_data;
-			for(i=0; i<count; i++) {
-				live[i] = live[i] | src_live[i];
-			}
+		if (blk->cond_to != NULL && blk->cond_to->analysis_data != NULL) {
+			LiveSetUnion(live, (LiveSet)blk->cond_to->analysis_data, count);
 		}
 	}
 	return live;
 }
 
-void MarkVarCollision(VarAllocInfo * info, LiveSet live, UInt16 idx)
+void MarkVarCollision(VarAllocInfo * info, LiveSet live, UInt32 idx)
+/*
+Purpose:
+	Mark variable with specified index as colliding with all variables in live set.
+*/
 {
-	UInt16 count, i;
+	UInt32 count, i;
 	count = VarSetCount(&info->vars);
-	for(i=0; i<count; i++) {
-		if (live[i] == 1) {
-			info->collisions[idx*count+i] = 1;
-			info->collisions[i*count+idx] = 1;
-		}
+	FOR_EACH_LIVE(live, count, i)
+		GraphAddEdge(&info->collisions, idx, i);
+	NEXT_LIVE
+}
+
+void MergeVarCollision(VarAllocInfo * info, UInt32 idx, UInt32 other_idx)
+/*
+Purpose:
+	Mark variable with specified index as colliding with all variables colliding with other variable.
+*/
+{
+	UInt32 n;
+	GraphNode * other = &info->collisions.nodes[other_idx];
+
+	// Adjacency list may grow while we are adding edges, so we must not cache it
+	for(n = 0; n < other->degree; n++) {
+		GraphAddEdge(&info->collisions, idx, other->adj[n]);
 	}
 }
 
@@ -106,12 +242,12 @@ Purpose:
 	If variable is not in the live set, do nothing.
 */
 {
-	UInt16 idx;
+	UInt32 idx;
 	if (var == NULL) return;
 	if (var->mode == INSTR_VAR) {
 		idx = var->set_index;
-		if (idx >= 0 && idx < VarSetCount(&info->vars) && VarSetItem(&info->vars, idx)->key == var) {
-			live[idx] = mark;
+		if (idx < VarSetCount(&info->vars) && VarSetItem(&info->vars, idx)->key == var) {
+			LiveSetMark(live, idx, mark);
 //			if (mark == 1) {
 				MarkVarCollision(info, live, idx);
 //			}
@@ -162,11 +298,17 @@ Purpose:
 }
 
 Bool VarAllocBlock(Var * proc, InstrBlock * blk, void * pinfo)
+/*
+Purpose:
+	Compute variables live at the start of the block and mark collisions of variables in the block.
+	Return true, if the set of live variables at the start of the block has changed.
+*/
 {
 	Instr * i;
+	Bool changed;
 	VarAllocInfo * info = (VarAllocInfo *)pinfo;
-	UInt16 count = VarSetCount(&info->vars);
-	LiveSet live = MergeLiveSets(blk, count, info->last_block);
+	UInt32 count = VarSetCount(&info->vars);
+	LiveSet live = MergeLiveSets(blk, count, info->last_block, &info->arena);
 	InstrInfo * ii;
 
 	// Traverse block backwards and mark variables as live/dead
@@ -193,9 +335,10 @@ Bool VarAllocBlock(Var * proc, InstrBlock * blk, void * pinfo)
 			}
 		}
 	}
+	changed = blk->analysis_data == NULL || !LiveSetEqual(live, (LiveSet)blk->analysis_data, count);
 	blk->analysis_data = live;
 
-	return true;
+	return changed;
 }
 
 
@@ -206,22 +349,86 @@ Bool FilterVar(Var * var)
 
 void PrintCollisions(VarAllocInfo * info)
 {
-	UInt16 i, j, count;
+	UInt32 i, j, count;
 
 	count = VarSetCount(&info->vars);
 
 	for(i = 0; i < count; i++) {
 		for(j = 0; j < count; j++) {
-			Print(info->collisions[i*count+j]==0?".":"X");
+			Print(GraphHasEdge(&info->collisions, i, j)?"X":".");
 		}
 		PrintEOL();
 	}
 
 }
 
-void BlockFreeLiveSet(InstrBlock * blk, void * pinfo)
+/*
+Variables, whose address may be used by other variable, are grouped by size.
+In every group, variables are sorted by their index.
+*/
+
+typedef struct {
+	UInt32   size;			// size of variables in the list
+	UInt32 * idx;			// indexes of variables
+	UInt32   count;
+	UInt32   capacity;
+} AllocCandidateList;
+
+typedef struct {
+	AllocCandidateList * lists;
+	UInt32     count;
+	UInt32     capacity;
+	MemArena * arena;
+} AllocCandidates;
+
+static void AllocCandidatesInit(AllocCandidates * cand, MemArena * arena)
+{
+	cand->lists = NULL;
+	cand->count = cand->capacity = 0;
+	cand->arena = arena;
+}
+
+static void * ArenaGrow(MemArena * arena, void * arr, UInt32 count, UInt32 * p_capacity, UInt32 item_size)
+/*
+Purpose:
+	Make array allocated from arena bigger, if it is full.
+*/
+{
+	void * new_arr;
+	if (count < *p_capacity) return arr;
+	*p_capacity = (*p_capacity == 0) ? 4 : *p_capacity * 2;
+	new_arr = MemArenaAlloc(arena, *p_capacity * item_size);
+	if (count > 0) MemMove(new_arr, arr, count * item_size);
+	return new_arr;
+}
+
+static void AllocCandidatesAdd(AllocCandidates * cand, UInt32 size, UInt32 idx)
+{
+	AllocCandidateList * list;
+	UInt32 n, j;
+
+	for(n = 0; n < cand->count; n++) {
+		if (cand->lists[n].size == size) break;
+	}
+	if (n == cand->count) {
+		cand->lists = (AllocCandidateList *)ArenaGrow(cand->arena, cand->lists, cand->count, &cand->capacity, sizeof(AllocCandidateList));
+		list = &cand->lists[cand->count++];
+		list->size = size;
+		list->idx  = NULL;
+		list->count = list->capacity = 0;
+	}
+	list = &cand->lists[n];
+
+	list->idx = (UInt32 *)ArenaGrow(cand->arena, list->idx, list->count, &list->capacity, sizeof(UInt32));
+	for(j = list->count; j > 0 && list->idx[j-1] > idx; j--) {
+		list->idx[j] = list->idx[j-1];
+	}
+	list->idx[j] = idx;
+	list->count++;
+}
+
+void BlockResetLiveSet(InstrBlock * blk, void * pinfo)
 {
-	MemFree(blk->analysis_data);
 	blk->analysis_data = NULL;
 }
 
@@ -235,8 +442,9 @@ Purpose:
 {
 	Var * var, * var2;
 	UInt32 size, adr;
-	UInt16 i, j, count;
+	UInt32 i, j, n, count;
 	VarAllocInfo info;
+	AllocCandidates cand;
 
 	// Get all local variables defined for the procedure.
 	// As we are going to assign addresses to them, labels, procedures, macros and registers are excluded.
@@ -245,12 +453,13 @@ Purpose:
 	ProcLocalVars(proc, &info.vars, &FilterVar);
 	count = VarSetCount(&info.vars);
 
-	// Graph of variable collisions is represented as 2D array.
-	// If item collision[a,b] is set to 1, it means the variables a and b are colliding (i.e. they are live at the same moment)
-	info.collisions = (UInt8 *)MemAllocEmpty(count * count);
+	MemArenaInit(&info.arena, 0);
+
+	// Graph of variable collisions is built while performing live analysis of the procedure.
+	GraphInit(&info.collisions, count, &info.arena);
 
 	// For first live set, mark all output variables as live.
-	info.last_block = (LiveSet)MemAllocEmpty(count);
+	info.last_block = LiveSetAlloc(&info.arena, count);
 	for(i=0; i<count; i++) {
 		var = VarSetItem(&info.vars, i)->key;
 		if (VarIsOutArg(var)) {
@@ -260,10 +469,21 @@ Purpose:
 
 //	VarSetPrint(&info.vars);
 
-	OptimizeDataFlowBack(proc, &VarAllocBlock, &info);
+	ForEachBlock(proc->instr, &BlockResetLiveSet, NULL);
+	DataFlowAnalysis(proc, DATAFLOW_BACKWARD, &VarAllocBlock, &info);
 
 //	PrintCollisions(&info);
 
+	// Variables with constant address, whose address may be reused by other variables
+
+	AllocCandidatesInit(&cand, &info.arena);
+	for(i = 0; i < count; i++) {
+		var = VarSetItem(&info.vars, i)->key;
+		if (VarIsIntConst(var->adr) && !OutVar(var) && !InVar(var)) {
+			AllocCandidatesAdd(&cand, TypeSize(var->type), i);
+		}
+	}
+
 	for(i = 0; i < count; i++) {
 		var = VarSetItem(&info.vars, i)->key;
 
@@ -272,31 +492,37 @@ Purpose:
 			size = TypeSize(var->type);		
 			if (size > 0) {
 
-				// Try to find another variable with address which does not collide with this variable
-				for(j = 0; j < count; j++) {
-					if (i != j && info.collisions[i*count+j] == 0) {
-						var2 = VarSetItem(&info.vars, j)->key;
-						if (VarIsIntConst(var2->adr) && !OutVar(var2) && !InVar(var2)) {
-							if (TypeSize(var2->type) == size) {
-								// We have found the variable, whose address we can use
-
-								// Mark variable to which we assign address of other variable to be conflicting with same variables as the other
-								MarkVarCollision(&info, &info.collisions[j*count], i);
-								MarkVarCollision(&info, &info.collisions[i*count], j);
-//								PrintVarName(var); Print("@"); PrintVarName(var2); PrintEOL();
-//								PrintCollisions(&info);
-
-								var->adr = var2;
-								goto next;
-							}
+				// Try to find another variable of same size with address which does not collide with this variable
+				// Candidates are sorted by index, so we use the first such variable in the set.
+				for(n = 0; n < cand.count; n++) {
+					if (cand.lists[n].size == size) break;
+				}
+				if (n < cand.count) {
+					for(j = 0; j < cand.lists[n].count; j++) {
+						if (!GraphHasEdge(&info.collisions, i, cand.lists[n].idx[j])) {
+							j = cand.lists[n].idx[j];
+							var2 = VarSetItem(&info.vars, j)->key;
+
+							// We have found the variable, whose address we can use
+
+							// Mark variable to which we assign address of other variable to be conflicting with same variables as the other
+							MergeVarCollision(&info, i, j);
+							MergeVarCollision(&info, j, i);
+//							PrintVarName(var); Print("@"); PrintVarName(var2); PrintEOL();
+//							PrintCollisions(&info);
+
+							var->adr = var2;
+							goto next;
 						}
 					}
-
 				}
 
 				if (HeapAllocBlock(heap, size, &adr) || HeapAllocBlock(&VAR_HEAP, size, &adr)) {
 //							PrintVarName(var); Print("@%d\n", adr);
 					var->adr = VarInt(adr);
+					if (!OutVar(var) && !InVar(var)) {
+						AllocCandidatesAdd(&cand, size, i);
+					}
 				} else {
 					// failed to alloc memory
 				}
@@ -307,10 +533,10 @@ next: ;
 
 	// Cleanup
 
-	MemFree(info.collisions);
-	MemFree(info.last_block);
+	GraphCleanup(&info.collisions);
+	MemArenaFree(&info.arena);
 	VarSetCleanup(&info.vars);
-	ForEachBlock(proc->instr, &BlockFreeLiveSet, NULL);
+	ForEachBlock(proc->instr, &BlockResetLiveSet, NULL);
 
 /*
 	for (var = VarFirstLocal(proc); var != NULL; var = VarNextLocal(proc, var)) {
@@ -340,10 +566,12 @@ next: ;
 
 void AllocateVariablesFromHeapNoOptim(Var * proc, MemHeap * heap)
 {
-	Var * var;
-	UInt32 size, adr;
+	Var * var, ** locals;
+	UInt32 size, adr, i, cnt;
 
-	for (var = VarFirstLocal(proc); var != NULL; var = VarNextLocal(proc, var)) {
+	locals = VarLocals(proc, &cnt);
+	for(i = 0; i < cnt; i++) {
+		var = locals[i];
 
 		// Scope can contain variables in subscope, we need to allocate them too
 		if (var->mode == INSTR_SCOPE) {
@@ -406,9 +634,12 @@ void HeapVarOp(MemHeap * heap, Var * var, int op)
 
 void HeapVariablesOp(MemHeap * heap, Var * scope, int op)
 {
-	Var * var;
+	Var * var, ** locals;
+	UInt32 i, cnt;
 
-	for (var = VarFirstLocal(scope); var != NULL; var = VarNextLocal(scope, var)) {
+	locals = VarLocals(scope, &cnt);
+	for(i = 0; i < cnt; i++) {
+		var = locals[i];
 		if (var->mode == INSTR_SCOPE) {
 			HeapVariablesOp(heap, var, op);
 		} else {
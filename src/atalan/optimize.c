@@ -13,15 +13,17 @@ Licensed under the MIT license: http://www.opensource.org/licenses/mit-license.p
 //extern Bool VERBOSE;
 extern Var   ROOT_PROC;
 
-void VarIncRead(Var * var)
+GLOBAL Bool VAR_USE_VALID;		// read and write counts are up to date and instructions update them when modified
+
+void VarAddRead(Var * var, Int16 n)
 {
 
 	InstrInfo * ii;
 	if (var != NULL) {
 		ii = &INSTR_INFO[var->mode];
 
-		var->read++;
-		if (var->write == 0) {
+		var->read += n;
+		if (var->write == 0 && n > 0) {
 			// variable should not be marked as uninitialized, if there has been label or jump or call
 			var->flags |= VarUninitialized;
 		}
@@ -37,33 +39,49 @@ void VarIncRead(Var * var)
 //		} else 
 		if (var->mode == INSTR_VAR) {
 			// Do not increment constant used as address
-			if (var->adr != NULL && var->adr->mode != INSTR_INT) VarIncRead(var->adr);
+			if (var->adr != NULL && var->adr->mode != INSTR_INT) VarAddRead(var->adr, n);
 		} else if (VarIsConst(var)) {
 		} else {
-			VarIncRead(var->adr);
-			VarIncRead(var->var);
+			VarAddRead(var->adr, n);
+			VarAddRead(var->var, n);
 		}
 	}
 }
 
-void VarIncWrite(Var * var)
+void VarAddWrite(Var * var, Int16 n)
 {
 	if (var != NULL) {
-		var->write++;
+		var->write += n;
 		if (var->mode == INSTR_ELEMENT || var->mode == INSTR_BYTE) {
-			VarIncWrite(var->adr);
-			VarIncRead(var->var);
+			VarAddWrite(var->adr, n);
+			VarAddRead(var->var, n);
 		} else if (var->mode == INSTR_DEREF) {
-			VarIncRead(var->var);
+			VarAddRead(var->var, n);
 		} else if (var->mode == INSTR_TUPLE) {
-			VarIncWrite(var->adr);
-			VarIncWrite(var->var);
+			VarAddWrite(var->adr, n);
+			VarAddWrite(var->var, n);
 		} else {
-			if (var->adr != NULL && var->adr->mode != INSTR_INT) VarIncRead(var->adr);
+			if (var->adr != NULL && var->adr->mode != INSTR_INT) VarAddRead(var->adr, n);
 		}
 	}
 }
 
+void InstrUseAdd(Instr * i, Int16 n)
+/*
+Purpose:
+	Add n to read and write counts of variables used by the instruction.
+	Instruction modifying functions use it to keep the counts up to date without calling VarUse (see VAR_USE_VALID).
+*/
+{
+	if (i->op == INSTR_LINE) return;
+	if (i->op == INSTR_CALL) return;		// Calls are used to compute call chains and there are other rules of computation
+
+	// Writes are registered as last to correctly detect uninitialized variable access
+	VarAddRead(i->arg1, n);
+	VarAddRead(i->arg2, n);
+	VarAddWrite(i->result, n);
+}
+
 void InstrVarUse(InstrBlock * code, InstrBlock * end)
 {
 	Instr * i;
@@ -74,14 +92,10 @@ void InstrVarUse(InstrBlock * code, InstrBlock * end)
 		for(i = blk->first; i != NULL; i = i->next) {
 
 			if (i->op == INSTR_LINE) continue;
-			if (i->op == INSTR_CALL) continue;		// Calls are used to compute call chains and there are other rules of computation
-
-			// Writes are registered as last to correctly detect uninitialized variable access
-			VarIncRead(i->arg1);
-			VarIncRead(i->arg2);
+			if (i->op == INSTR_CALL) continue;
 
+			InstrUseAdd(i, 1);
 			result = i->result;
-			VarIncWrite(result);
 
 			// In instructions like op X, X, ? or op X, ?, X, X is induction variable
 
@@ -111,7 +125,7 @@ Purpose:
 				// Procedure that has no defined body can still define variables and arguments it uses.
 				// We must mark these variables as used, if the procedure is used.
 				for(var = VarFirstLocal(proc); var != NULL; var = VarNextLocal(proc, var)) {
-					VarIncRead(var);
+					VarAddRead(var, 1);
 				}
 			}
 		}
@@ -132,6 +146,55 @@ Purpose:
 
 }
 
+void VarUseUpdate()
+/*
+Purpose:
+	Make sure read and write counts of variables are valid.
+	Counts are computed only if some code modification has not updated them.
+*/
+{
+	if (!VAR_USE_VALID) {
+		VarUse();
+		VAR_USE_VALID = true;
+	}
+}
+
+#ifdef DEBUG
+void VarUseCheck()
+/*
+Purpose:
+	Test, that incrementally updated read and write counts are same as the counts computed from scratch.
+*/
+{
+	Var * var;
+	UInt32 cnt, n;
+	UInt16 * use;
+
+	cnt = 0;
+	FOR_EACH_VAR(var)
+		cnt++;
+	NEXT_VAR
+
+	use = (UInt16 *)MemAlloc(sizeof(UInt16) * 2 * cnt);
+	n = 0;
+	FOR_EACH_VAR(var)
+		use[n++] = var->read;
+		use[n++] = var->write;
+	NEXT_VAR
+
+	VarUse();
+
+	n = 0;
+	FOR_EACH_VAR(var)
+		if (var->type->variant != TYPE_PROC && (use[n] != var->read || use[n+1] != var->write)) {
+			InternalError("Invalid use count of %.40s: R%d W%d (should be R%d W%d)", var->name, use[n], use[n+1], var->read, var->write);
+		}
+		n += 2;
+	NEXT_VAR
+	MemFree(use);
+}
+#endif
+
 //TODO: Replace variable management (keep array of those variables and reuse them)
 
 Int16 VarTestReplace(Var ** p_var, Var * from, Var * to)
@@ -224,9 +287,12 @@ Purpose:
 Int16 InstrReplaceVar(Instr * i, Var * from, Var * to)
 {
 	Int16 n = 0;
+	if (VAR_USE_VALID) InstrUseAdd(i, -1);
 	n += VarReplace(&i->result, from, to);
 	n += VarReplace(&i->arg1, from, to);
 	n += VarReplace(&i->arg2, from, to);
+	if (n > 0) INSTR_CHANGE_CNT++;
+	if (VAR_USE_VALID) InstrUseAdd(i, 1);
 	return n;
 }
 
@@ -317,29 +383,357 @@ Bool InstrSpill(Instr * i, Var * var)
 }
 
 
-void OptimizeCombined(Var * proc)
+/*
+
+============
+Pass manager
+============
+
+Optimization passes are run in order specified by pipeline.
+Pipeline is comma separated list of pass names (see OPT_PASSES).
+Passes enclosed in parentheses form a group. Group is repeated until no pass in the group modifies the code
+(or until PASS_ITERATIONS_MAX iterations have been performed).
+Group reports modification only if the code has been modified in it's last iteration.
+
+Every step of the pipeline is performed for all used procedures before next step is started.
+Global passes are performed only once for whole program.
+
+For every pass and procedure, we record time, number of runs and number of changed instructions.
+
+Incremental passes process only blocks modified since their last run on the procedure (see MarkDirtyBlocks).
+Other passes do not report which blocks they modified, so all blocks are considered modified after they change the code.
+
+While the pipeline runs, read and write counts of variables are updated by instruction modifying functions (see VAR_USE_VALID).
+Passes modifying instructions directly must invalidate them, so they get recomputed when some pass needs them.
+
+*/
+
+#define PASS_GLOBAL 1		// pass processes whole program, not single procedure
+#define PASS_EXP    2		// pass creates expression objects, that must be released using ExpCleanup
+#define PASS_INCREMENTAL 4	// pass processes only dirty blocks
+#define PASS_UNTRACKED 8	// pass does not report modification of the code and does not update read and write counts
+
+typedef struct {
+	char * name;
+	Bool (*run)(Var * proc);
+	UInt8 flags;
+} OptPass;
+
+static Bool PassJumps(Var * proc)
+{
+	OptimizeJumps(proc);
+	return false;
+}
+
+static Bool PassDeadCode(Var * proc)
+{
+	DeadCodeElimination(proc);
+	return false;
+}
+
+static Bool PassVarUse(Var * proc)
+{
+	VarUse();
+	VAR_USE_VALID = true;
+	return false;
+}
+
+static OptPass OPT_PASSES[] = {
+	{ "values",       &OptimizeValues, PASS_EXP + PASS_INCREMENTAL },
+	{ "live",         &OptimizeLive, PASS_INCREMENTAL },
+	{ "live2",        &OptimizeLive2, 0 },
+	{ "merge_branch", &OptimizeMergeBranchCode, 0 },
+	{ "var_merge",    &OptimizeVarMerge, 0 },
+	{ "loops",        &OptimizeLoops, 0 },
+	{ "jumps",        &PassJumps, PASS_UNTRACKED },
+	{ "dce",          &PassDeadCode, PASS_UNTRACKED },
+	{ "var_use",      &PassVarUse, PASS_GLOBAL }
+};
+
+#define OPT_PASS_CNT (sizeof(OPT_PASSES) / sizeof(OptPass))
+
+// live must be called right after values, to keep next_use info
+#define PASS_PIPELINE_DEFAULT "jumps,((values,live,merge_branch),live,var_merge,loops),var_use,live2,dce,jumps,jumps"
+
+typedef struct PassStepTag PassStep;
+
+struct PassStepTag {
+	PassStep * next;
+	OptPass  * pass;		// pass to run (NULL if this step is group)
+	PassStep * group;		// first step of the group
+};
+
+typedef struct {
+	UInt32 runs;
+	UInt32 modified;		// number of runs, that modified the code
+	UInt32 changes;			// number of changed instructions
+	UInt64 time;			// time spent in the pass (microseconds)
+	UInt32 stamp;			// BLOCK_STAMP at the start of last run (0 if the pass has not been run yet)
+} PassStats;
+
+typedef struct PassProcStatsTag PassProcStats;
+
+struct PassProcStatsTag {
+	PassProcStats * next;
+	Var * proc;
+	UInt32 iterations;		// total number of iterations of all groups
+	PassStats pass[OPT_PASS_CNT];
+};
+
+GLOBAL UInt16 PASS_ITERATIONS_MAX;		// maximal number of iterations of pass group (0 = unlimited)
+GLOBAL PassStep * PASS_PIPELINE;
+GLOBAL PassProcStats * PASS_STATS;		// list of statistics for every optimized procedure
+GLOBAL PassStep * PASS_STEP;			// step being performed by PassStepProc
+
+static PassStep * PassParseSteps(char ** p_text);
+
+static PassStep * PassParseStep(char ** p_text)
+/*
+Purpose:
+	Parse one step of the pipeline (either pass name or parenthesized group).
+	Return NULL in case of error.
+*/
 {
+	PassStep * step;
+	char * s, * e;
+	UInt16 n;
+
+	s = *p_text;
+	step = MemAllocStruct(PassStep);
+	if (*s == '(') {
+		s++;
+		step->group = PassParseSteps(&s);
+		if (step->group == NULL) return NULL;
+		if (*s != ')') {
+			PrintFmt("Missing ')' in optimization pipeline\n");
+			return NULL;
+		}
+		s++;
+	} else {
+		for(e = s; *e != 0 && *e != ',' && *e != '(' && *e != ')'; e++);
+		for(n = 0; n < OPT_PASS_CNT; n++) {
+			if (strlen(OPT_PASSES[n].name) == (size_t)(e - s) && StrEqualPrefix(OPT_PASSES[n].name, s, e - s)) break;
+		}
+		if (n == OPT_PASS_CNT) {
+			PrintFmt("Unknown optimization pass '%.*s'\n", (int)(e - s), s);
+			return NULL;
+		}
+		step->pass = &OPT_PASSES[n];
+		s = e;
+	}
+	*p_text = s;
+	return step;
+}
+
+static PassStep * PassParseSteps(char ** p_text)
+/*
+Purpose:
+	Parse comma separated list of steps.
+*/
+{
+	PassStep * first, * step, * last;
+	first = last = NULL;
+	do {
+		if (first != NULL) (*p_text)++;		// skip ','
+		step = PassParseStep(p_text);
+		if (step == NULL) return NULL;
+		if (last == NULL) {
+			first = step;
+		} else {
+			last->next = step;
+		}
+		last = step;
+	} while(**p_text == ',');
+	return first;
+}
+
+Bool PassPipelineParse(char * text)
+/*
+Purpose:
+	Define the pipeline of optimization passes.
+	Return false, if the pipeline definition is not valid.
+*/
+{
+	char * s = text;
+	PassStep * steps;
+
+	steps = PassParseSteps(&s);
+	if (steps == NULL) return false;
+	if (*s != 0) {
+		PrintFmt("Unexpected '%c' in optimization pipeline\n", *s);
+		return false;
+	}
+	PASS_PIPELINE = steps;
+	return true;
+}
+
+static PassProcStats * PassProcStatsFind(Var * proc)
+{
+	PassProcStats * stats;
+	for(stats = PASS_STATS; stats != NULL; stats = stats->next) {
+		if (stats->proc == proc) return stats;
+	}
+	stats = MemAllocStruct(PassProcStats);
+	stats->proc = proc;
+	stats->next = PASS_STATS;
+	PASS_STATS = stats;
+	return stats;
+}
+
+static Bool PassRun(OptPass * pass, Var * proc)
+{
+	PassStats * stats;
+	UInt64 time;
+	UInt32 changes;
 	Bool modified;
+
+	time = TimeMicro();
+	changes = INSTR_CHANGE_CNT;
+	stats = &PassProcStatsFind(proc)->pass[pass - OPT_PASSES];
+
+	BLOCK_DIRTY_SINCE = stats->stamp;
+	BLOCK_STAMP++;
+	stats->stamp = BLOCK_STAMP;
+
+	modified = pass->run(proc);
+
+	if (FlagOff(pass->flags, PASS_INCREMENTAL + PASS_GLOBAL)) {
+		if (modified || INSTR_CHANGE_CNT != changes || FlagOn(pass->flags, PASS_UNTRACKED)) {
+			ProcChanged(proc);
+		}
+	}
+
+	if (FlagOn(pass->flags, PASS_UNTRACKED)) {
+		VAR_USE_VALID = false;
+	}
+#ifdef DEBUG
+	if (VAR_USE_VALID) VarUseCheck();
+#endif
+
+	stats->runs++;
+	if (modified) stats->modified++;
+	stats->changes += INSTR_CHANGE_CNT - changes;
+	stats->time += TimeMicro() - time;
+	return modified;
+}
+
+static Bool PassGroupRun(PassStep * group, Var * proc);
+
+static Bool PassStepsRun(PassStep * step, Var * proc)
+/*
+Purpose:
+	Run the list of steps once.
+	Return true, if some of the steps modified the code.
+*/
+{
+	Bool modified = false;
+	for(; step != NULL; step = step->next) {
+		if (step->pass != NULL) {
+			modified |= PassRun(step->pass, proc);
+		} else {
+			modified |= PassGroupRun(step->group, proc);
+		}
+	}
+	return modified;
+}
+
+static Bool PassGroupRun(PassStep * group, Var * proc)
+{
+	Bool modified;
+	UInt32 n = 0;
 	do {
-		do {
-			modified = OptimizeValues(proc);
-			modified |= OptimizeLive(proc);			// We need to call OptimizeLive as second, to keep next_use info
-			modified |= OptimizeMergeBranchCode(proc);
-		} while(modified);
+		modified = PassStepsRun(group, proc);
+		n++;
+	} while(modified && (PASS_ITERATIONS_MAX == 0 || n < PASS_ITERATIONS_MAX));
+	PassProcStatsFind(proc)->iterations += n;
+	return modified;
+}
 
-		modified |= OptimizeLive(proc);	
-		modified |= OptimizeVarMerge(proc);
-		modified |= OptimizeLoops(proc);
-	} while(modified);
+static void PassStepProc(Var * proc)
+/*
+Purpose:
+	Perform top level step of the pipeline on specified procedure.
+*/
+{
+	PassStep * step = PASS_STEP;
+	if (step->group != NULL) {
+		if (Verbose(proc)) {
+			PrintHeader(2, proc->name);
+		}
+		PassGroupRun(step->group, proc);
+		ExpCleanup();
+	} else {
+		PassRun(step->pass, proc);
+		if (FlagOn(step->pass->flags, PASS_EXP)) ExpCleanup();
+	}
+}
 
+void PassPipelineRun()
+/*
+Purpose:
+	Optimize all used procedures using the pipeline of passes.
+	If no pipeline has been defined, default pipeline is used.
+*/
+{
+	if (PASS_PIPELINE == NULL) {
+		PassPipelineParse(PASS_PIPELINE_DEFAULT);
+	}
+
+	VAR_USE_VALID = false;
+
+	for(PASS_STEP = PASS_PIPELINE; PASS_STEP != NULL; PASS_STEP = PASS_STEP->next) {
+		if (PASS_STEP->pass != NULL && FlagOn(PASS_STEP->pass->flags, PASS_GLOBAL)) {
+			PassRun(PASS_STEP->pass, &ROOT_PROC);
+		} else {
+			ProcessUsedProc(&PassStepProc);
+		}
+	}
+
+	// Outside of optimization, code is not modified using functions updating the counts
+	VAR_USE_VALID = false;
 }
 
-void ProcOptimize(Var * proc)
+void PassStatsPrint()
+/*
+Purpose:
+	Print time, number of runs and changed instructions for every pass and procedure.
+*/
 {
-	if (Verbose(proc)) {
-		PrintHeader(2, proc->name);
+	PassProcStats * stats;
+	PassStats * ps, total[OPT_PASS_CNT];
+	UInt64 time;
+	UInt16 n;
+
+	if (PASS_STATS == NULL) return;
+
+	PrintHeader(1, "Pass statistics");
+	MemEmptyVar(total);
+
+	PrintFmt("%-24s %-12s %10s %10s %10s %10s\n", "procedure", "pass", "time [ms]", "runs", "modified", "changes");
+	for(stats = PASS_STATS; stats != NULL; stats = stats->next) {
+		time = 0;
+		for(n = 0; n < OPT_PASS_CNT; n++) {
+			ps = &stats->pass[n];
+			if (ps->runs == 0) continue;
+			PrintFmt("%-24.24s %-12s %10.2f %10ld %10ld %10ld\n", stats->proc->name, OPT_PASSES[n].name, (double)ps->time / 1000, ps->runs, ps->modified, ps->changes);
+			time += ps->time;
+			total[n].runs     += ps->runs;
+			total[n].modified += ps->modified;
+			total[n].changes  += ps->changes;
+			total[n].time     += ps->time;
+		}
+		PrintFmt("%-24.24s %-12s %10.2f %10s iterations: %ld\n", stats->proc->name, "(total)", (double)time / 1000, "", stats->iterations);
+	}
+	PrintEOL();
+
+	time = 0;
+	for(n = 0; n < OPT_PASS_CNT; n++) {
+		ps = &total[n];
+		if (ps->runs == 0) continue;
+		PrintFmt("%-24s %-12s %10.2f %10ld %10ld %10ld\n", "(all)", OPT_PASSES[n].name, (double)ps->time / 1000, ps->runs, ps->modified, ps->changes);
+		time += ps->time;
 	}
-	OptimizeCombined(proc);
+	PrintFmt("%-24s %-12s %10.2f\n", "(all)", "(total)", (double)time / 1000);
 }
 
 /*
@@ -774,19 +774,34 @@ typedef struct {
 	Var * min[5];
 	Int16 min_dist;
 	UInt16 cnt;
+	char * key;			// key of searched name (NULL if there is no such name)
+	UInt16 len;			// length of searched name
 } SimmilarNames;
 
-void SimmilarNamesInit(SimmilarNames * names)
+void SimmilarNamesInit(SimmilarNames * names, char * name)
 {
 	names->min_dist = 3;
 	names->cnt = 0;
+	names->key = NameFind(name);
+	names->len = StrLen(name);
 }
 
 void SimmilarNamesAdd(SimmilarNames * names, char * name,  Var * v)
 {
 	Int16 dist;
+	UInt16 len;
 	if (v->name != NULL && v->idx == 0) {
-		dist = StrEditDistance(name, v->name);
+
+		// Names are interned, so we do not need to compute the distance for same names.
+		// Names with length difference of two or more characters can not be similar.
+
+		if (NameKey(v->name) == names->key) {
+			dist = 0;
+		} else {
+			len = StrLen(v->name);
+			if (len > names->len + 1 || len + 1 < names->len) return;
+			dist = StrEditDistance(name, v->name);
+		}
 		if (dist < 2) {
 			if (dist < names->min_dist) {
 				names->min[0] = v;
@@ -825,7 +840,7 @@ void ReportSimilarNames(char * name)
 	// Do not try to suggest simmilar names, if the variable consists of only one character
 
 	if (len > 1) {
-		SimmilarNamesInit(&names);
+		SimmilarNamesInit(&names, name);
 		for(scope = SCOPE; scope != NULL; scope = scope->scope) {
 			FOR_EACH_LOCAL(scope, v)
 				SimmilarNamesAdd(&names, name, v);
@@ -851,7 +866,7 @@ void ReportSimilarNames(char * name)
 	}
 
 	// We are trying to locate same variable in different scope
-	SimmilarNamesInit(&names);
+	SimmilarNamesInit(&names, name);
 	FOR_EACH_VAR(v)
 		if (!VarIsArg(v)) {
 			SimmilarNamesAdd(&names, name, v);
@@ -2028,8 +2043,7 @@ Syntax:
 						idx = VarAllocScopeTmp(NULL, INSTR_VAR, type);
 						
 						var = VarAlloc(INSTR_ELEMENT, name, 0);
-						var->adr = arr;
-						var->var = idx;
+						VarSetOpArgs(var, arr, idx);
 						var->line_no = LINE_NO;
 						var->line_pos = token_pos;
 						var->file    = SRC_FILE;
@@ -3162,7 +3176,7 @@ parsed:
 		// If scope has not been explicitly defined, use current scope
 
 		if (var->scope == NULL) {
-			var->scope = SCOPE;
+			VarChangeScope(var, SCOPE);
 		}
 
 		if (var->mode == INSTR_VOID) {
@@ -4029,11 +4043,16 @@ void ParseRule()
 		ResolveRuleArg(rule, &rule->arg[i]);
 	}
 
-	// Number of cycles may be defined after hash '#3'
+	// Number of cycles may be defined after hash '#3', size of the instruction in bytes may follow after colon '#3:2'
 	if (TOK == TOKEN_HASH) {
 		ExpectToken(TOKEN_INT);
 		rule->cycles = (UInt8)LEX.n;			
 		NextToken();
+		if (TOK == TOKEN_COLON) {
+			ExpectToken(TOKEN_INT);
+			rule->size = (UInt8)LEX.n;
+			NextToken();
+		}
 	}
 
 	PARSING_PATTERN = false;
@@ -105,11 +105,14 @@ Purpose:
 	return false;
 }
 
+static void RuleIndexFree(RuleIndex * index);
+
 void RuleSetInit(RuleSet * ruleset)
 {
 	UInt16 op;
 	for(op=0; op<INSTR_CNT; op++) {
 		ruleset->rules[op] = NULL;
+		ruleset->index[op] = NULL;
 	}
 }
 
@@ -144,6 +147,10 @@ Purpose:
 		prev_r->next = rule;
 	}
 
+	// Index of rules for the operation must be built again
+	RuleIndexFree(ruleset->index[op]);
+	ruleset->index[op] = NULL;
+	RuleCacheInvalidate();
 }
 
 void RuleRegister(Rule * rule)
@@ -158,6 +165,7 @@ Purpose:
 	} else {
 
 		if (rule->to->first->op == INSTR_EMIT) {
+			EmitRuleCompile(rule);
 			RuleSetAddRule(&INSTR_RULES, rule);
 		} else {
 			RuleSetAddRule(&TRANSLATE_RULES, rule);
@@ -165,6 +173,56 @@ Purpose:
 	}
 }
 
+/*
+=========
+Rule cost
+=========
+
+Optimizations compare alternative instructions using cost of rules used to emit them.
+Rule may specify number of cycles and size in bytes of the instruction as #cycles:size.
+Rule, which emits some code but does not specify the size, is considered to be RULE_SIZE_UNKNOWN bytes long,
+so it never looks cheaper than a rule with known size.
+
+GOAL_SPEED     cost is number of cycles
+GOAL_SIZE      cost is size, cycles decide only between instructions of the same size
+GOAL_WEIGHTED  cost is cycles * loop weight + size * OPTIMIZE_BYTE_COST
+
+Code in a loop is executed repeatedly, so cycles spent there are more expensive than code size.
+We expect every loop to be executed 2^LOOP_WEIGHT_SHIFT times.
+*/
+
+#define LOOP_WEIGHT_SHIFT 3
+#define LOOP_WEIGHT_MAX_DEPTH 4
+#define RULE_SIZE_UNKNOWN 255
+
+GLOBAL OptimizeGoal OPTIMIZE_GOAL;
+GLOBAL UInt16 OPTIMIZE_BYTE_COST;		// number of cycles one byte of code is worth (used for GOAL_WEIGHTED)
+
+UInt32 RuleCost(Rule * rule, UInt16 loop_depth)
+/*
+Purpose:
+	Return cost of instruction emitted using the rule.
+	Lower cost means better instruction.
+Arguments:
+	loop_depth	number of loops containing the instruction
+*/
+{
+	UInt32 cycles = rule->cycles;
+	UInt32 size = rule->size;
+
+	if (size == 0 && rule->to != NULL && rule->to->first != NULL) size = RULE_SIZE_UNKNOWN;
+
+	switch(OPTIMIZE_GOAL) {
+	case GOAL_SIZE:
+		return (size << 8) + cycles;
+	case GOAL_WEIGHTED:
+		if (loop_depth > LOOP_WEIGHT_MAX_DEPTH) loop_depth = LOOP_WEIGHT_MAX_DEPTH;
+		return (cycles << (LOOP_WEIGHT_SHIFT * loop_depth)) + size * OPTIMIZE_BYTE_COST;
+	default:
+		return cycles;
+	}
+}
+
 /***********************************************
 
   Rules garbage collector
@@ -204,6 +262,8 @@ void RuleSetGarbageCollect(RuleSet * ruleset)
 
 void RulesGarbageCollect()
 {
+	// Released types may be reused, so the cached matches are not valid anymore
+	RuleCacheInvalidate();
 	RuleSetGarbageCollect(&TRANSLATE_RULES);
 	RuleSetGarbageCollect(&INSTR_RULES);
 }
@@ -234,6 +294,135 @@ void EmptyRuleArgs()
 	}
 }
 
+/*
+===============
+Rule statistics
+===============
+
+Rule engine counts the work it performs, so it is possible to find out, which rules and instructions are
+expensive to translate. Report is printed using -stats switch (see RuleStatsPrint).
+
+For every instruction we count lookups of rules, rules tried during lookup (attempts) and successful lookups.
+For every rule we count, how many times it has been tried and how many times it matched.
+We also record recursion depth of InstrTranslate3, which splits instructions that can not be translated directly.
+*/
+
+#define RULE_STATS_DEPTH_CNT 16		// depth of InstrTranslate3 recursion is recorded up to this level
+#define RULE_STATS_TOP_RULES 20		// number of the most used rules printed in report
+
+typedef struct {
+	UInt32 lookups[INSTR_CNT];		// number of rule lookups for the instruction
+	UInt32 found[INSTR_CNT];		// number of lookups, that found the rule
+	UInt32 attempts[INSTR_CNT];		// number of rules tried (RuleMatch calls)
+	UInt32 expansions[INSTR_CNT];	// number of translation rules expanded by GenMatchedRule
+	UInt32 arg_matches;				// number of ArgMatch calls (including recursive calls)
+	UInt32 translations;			// number of InstrTranslate3 calls
+	UInt32 bigger_result;			// number of attempts to translate the instruction with bigger result
+	UInt32 depth;					// current recursion depth of InstrTranslate3
+	UInt32 depth_max;				// maximal recursion depth of InstrTranslate3
+	UInt32 depth_cnt[RULE_STATS_DEPTH_CNT];	// number of InstrTranslate3 calls on every depth
+} RuleStats;
+
+GLOBAL RuleStats RULE_STATS;
+
+static int RuleStatsCompareOps(const void * l, const void * r)
+{
+	UInt32 la = RULE_STATS.attempts[*(InstrOp *)l];
+	UInt32 ra = RULE_STATS.attempts[*(InstrOp *)r];
+	if (la != ra) return la > ra ? -1 : 1;
+	return 0;
+}
+
+static int RuleStatsCompareRules(const void * l, const void * r)
+{
+	Rule * lr = *(Rule **)l;
+	Rule * rr = *(Rule **)r;
+	if (lr->match_cnt != rr->match_cnt) return lr->match_cnt > rr->match_cnt ? -1 : 1;
+	if (lr->attempt_cnt != rr->attempt_cnt) return lr->attempt_cnt > rr->attempt_cnt ? -1 : 1;
+	return 0;
+}
+
+static double RuleStatsRatio(UInt32 attempts, UInt32 matches)
+{
+	if (matches == 0) return attempts;
+	return (double)attempts / matches;
+}
+
+static UInt32 RuleStatsCollect(RuleSet * ruleset, Rule ** rules, UInt32 cnt)
+/*
+Purpose:
+	Add rules from the rule set, that have been tried at least once, to the array.
+	If the array is NULL, the rules are only counted.
+*/
+{
+	InstrOp op;
+	Rule * rule;
+	for(op = INSTR_NULL; op < INSTR_CNT; op++) {
+		for(rule = ruleset->rules[op]; rule != NULL; rule = rule->next) {
+			if (rule->attempt_cnt == 0) continue;
+			if (rules != NULL) rules[cnt] = rule;
+			cnt++;
+		}
+	}
+	return cnt;
+}
+
+void RuleStatsPrint()
+/*
+Purpose:
+	Print report with statistics of the rule engine.
+	Instructions are sorted by number of rules tried, rules are sorted by number of matches.
+*/
+{
+	InstrOp ops[INSTR_CNT];
+	InstrOp op;
+	UInt32 op_cnt, rule_cnt, n;
+	Rule ** rules, * rule;
+	char loc[64];
+
+	PrintHeader(1, "Rule statistics");
+
+	op_cnt = 0;
+	for(op = INSTR_NULL; op < INSTR_CNT; op++) {
+		if (RULE_STATS.lookups[op] > 0 || RULE_STATS.expansions[op] > 0) ops[op_cnt++] = op;
+	}
+	qsort(ops, op_cnt, sizeof(InstrOp), &RuleStatsCompareOps);
+
+	PrintFmt("%-12s %10s %10s %10s %10s %10s\n", "instruction", "lookups", "found", "attempts", "att/found", "expanded");
+	for(n = 0; n < op_cnt; n++) {
+		op = ops[n];
+		PrintFmt("%-12s %10ld %10ld %10ld %10.1f %10ld\n", INSTR_INFO[op].name,
+			RULE_STATS.lookups[op], RULE_STATS.found[op], RULE_STATS.attempts[op],
+			RuleStatsRatio(RULE_STATS.attempts[op], RULE_STATS.found[op]), RULE_STATS.expansions[op]);
+	}
+	PrintEOL();
+
+	PrintFmt("Argument matches: %ld\n", RULE_STATS.arg_matches);
+	PrintFmt("InstrTranslate3 calls: %ld, maximal depth: %ld, bigger result attempts: %ld\n", RULE_STATS.translations, RULE_STATS.depth_max, RULE_STATS.bigger_result);
+	Print("Calls per depth:");
+	for(n = 0; n < RULE_STATS_DEPTH_CNT && RULE_STATS.depth_cnt[n] > 0; n++) {
+		PrintFmt(" %ld", RULE_STATS.depth_cnt[n]);
+	}
+	PrintEOL();
+	RuleCachePrintStats();
+	PrintEOL();
+
+	rule_cnt = RuleStatsCollect(&INSTR_RULES, NULL, RuleStatsCollect(&TRANSLATE_RULES, NULL, 0));
+	if (rule_cnt == 0) return;
+
+	rules = (Rule **)MemAlloc(sizeof(Rule *) * rule_cnt);
+	RuleStatsCollect(&INSTR_RULES, rules, RuleStatsCollect(&TRANSLATE_RULES, rules, 0));
+	qsort(rules, rule_cnt, sizeof(Rule *), &RuleStatsCompareRules);
+
+	PrintFmt("%-24s %-12s %10s %10s\n", "rule", "instruction", "matches", "attempts");
+	for(n = 0; n < rule_cnt && n < RULE_STATS_TOP_RULES; n++) {
+		rule = rules[n];
+		sprintf(loc, "%.40s(%d)", rule->file != NULL ? rule->file->name : "", rule->line_no);
+		PrintFmt("%-24s %-12s %10ld %10ld\n", loc, INSTR_INFO[rule->op].name, rule->match_cnt, rule->attempt_cnt);
+	}
+	MemFree(rules);
+}
+
 static Bool ArgMatch(RuleArg * pattern, Var * arg, RuleArgVariant parent_variant);
 
 Bool RuleMatch(Rule * rule, Instr * i, CompilerPhase match_mode)
@@ -246,6 +435,9 @@ Purpose:
 
 	if (i->op != rule->op) return false;
 
+	RULE_STATS.attempts[rule->op]++;
+	rule->attempt_cnt++;
+
 	EmptyRuleArgs();
 	MATCH_MODE = match_mode;
 
@@ -254,6 +446,7 @@ Purpose:
 		&& ArgMatch(&rule->arg[2], i->arg2, RULE_UNDEFINED);
 
 	if (match) {
+		rule->match_cnt++;
 		if (RULE_MATCH_BREAK) {
 			RULE_MATCH_BREAK = true;
 		}
@@ -313,6 +506,8 @@ static Bool ArgMatch(RuleArg * pattern, Var * arg, RuleArgVariant parent_variant
 	UInt8 j;
 	RuleArgVariant v = pattern->variant;
 
+	RULE_STATS.arg_matches++;
+
 	if (arg == NULL) return v == RULE_ANY;
 
 	atype = arg->type;
@@ -458,6 +653,509 @@ static Bool ArgMatch(RuleArg * pattern, Var * arg, RuleArgVariant parent_variant
 	return true;
 }
 
+/***********************************************
+
+  Rule index
+
+************************************************/
+
+/*
+Rules for every operation are compiled into index, which is used to quickly find the candidate rules for an instruction.
+
+Every instruction argument is classified by it's shape (mode, whether it is constant and whether it is register).
+For every argument position and shape, index contains bit set of rules that may match an argument of that shape.
+Rules requiring exact register (or one of several registers) are indexed by the register instead of the shape.
+
+Intersection of the sets for all three arguments gives candidate rules.
+The bits in sets are in the order of rule specificity, so trying candidates in order using RuleMatch
+finds the same rule as trying all the rules in the list.
+Types of arguments are not indexed, they are tested by RuleMatch.
+*/
+
+typedef enum {
+	SHAPE_VAR,
+	SHAPE_INT,
+	SHAPE_CONST,
+	SHAPE_TEXT,
+	SHAPE_ELEMENT,
+	SHAPE_BYTE,
+	SHAPE_DEREF,
+	SHAPE_TUPLE,
+	SHAPE_RANGE,
+	SHAPE_ADD,
+	SHAPE_SUB,
+	SHAPE_OTHER,
+	SHAPE_MODE_CNT
+} ArgShapeMode;
+
+#define SHAPE_NULL 0
+#define SHAPE_CNT (1 + SHAPE_MODE_CNT * 4)
+#define ArgShape(mode, is_const, is_reg) (1 + ((mode) << 2) + ((is_const) << 1) + (is_reg))
+
+typedef struct {
+	Var * reg;					// register
+	LiveSet rules;				// rules requiring this register
+} RuleRegIndex;
+
+typedef struct {
+	LiveSet shape[SHAPE_CNT];	// rules that may match argument of specified shape
+	RuleRegIndex * regs;
+	UInt32 reg_count;
+} RuleArgIndex;
+
+struct RuleIndexTag {
+	MemArena arena;				// all memory of the index
+	UInt32 count;				// number of rules
+	Rule ** rules;				// rules in order of specificity
+	RuleArgIndex arg[3];
+	LiveSet candidates;			// work sets used when searching for rule
+	LiveSet arg_rules;
+};
+
+static ArgShapeMode ArgShapeModeOf(InstrOp mode)
+{
+	switch(mode) {
+	case INSTR_VAR:     return SHAPE_VAR;
+	case INSTR_INT:     return SHAPE_INT;
+	case INSTR_CONST:   return SHAPE_CONST;
+	case INSTR_TEXT:    return SHAPE_TEXT;
+	case INSTR_ELEMENT: return SHAPE_ELEMENT;
+	case INSTR_BYTE:    return SHAPE_BYTE;
+	case INSTR_DEREF:   return SHAPE_DEREF;
+	case INSTR_TUPLE:   return SHAPE_TUPLE;
+	case INSTR_RANGE:   return SHAPE_RANGE;
+	case INSTR_ADD:     return SHAPE_ADD;
+	case INSTR_SUB:     return SHAPE_SUB;
+	default:            return SHAPE_OTHER;
+	}
+}
+
+static UInt8 VarShape(Var * var)
+{
+	if (var == NULL) return SHAPE_NULL;
+	return ArgShape(ArgShapeModeOf(var->mode), VarIsConst(var) ? 1 : 0, FlagOn(var->submode, SUBMODE_REG) ? 1 : 0);
+}
+
+static Var * VarAliasTarget(Var * var)
+/*
+Purpose:
+	Return the variable, to which the variable is (possibly indirectly) aliased.
+	Two non-tuple variables are equal (see VarIsEqual), if they have the same alias target.
+*/
+{
+	while(var->mode == INSTR_VAR && var->adr != NULL) var = var->adr;
+	return var;
+}
+
+static Bool RuleVarIsRegister(Var * var)
+/*
+Purpose:
+	Test, that the variable is CPU register (see InitCPU), so we can index rules by it.
+*/
+{
+	return CPU->SCOPE != NULL && var->scope == CPU->SCOPE && var->mode == INSTR_VAR && var->adr == NULL && var->type != NULL && var->type->variant == TYPE_INT;
+}
+
+static Bool RuleArgRegisters(RuleArg * pattern, Var ** regs, UInt32 * p_count)
+/*
+Purpose:
+	If the pattern matches only specified registers, fill the array with them and return true.
+	Return false, if the pattern may match other arguments.
+*/
+{
+	Var * var, * o;
+	UInt32 count = 0;
+
+	if (pattern->variant == RULE_REGISTER) {
+		var = pattern->var;
+		if (var == NULL || VarIsConst(var)) return false;
+		var = VarAliasTarget(var);
+		if (!RuleVarIsRegister(var)) return false;
+		regs[count++] = var;
+
+	} else if (pattern->variant == RULE_VARIANT) {
+		// Same traversal as in VarIsOneOf
+		o = pattern->var;
+		if (o->mode != INSTR_TUPLE) {
+			if (o->adr != NULL) o = o->adr;
+		}
+		while(o != NULL) {
+			var = (o->mode == INSTR_TUPLE) ? o->adr : o;
+			if (var != NULL) {
+				if (count == MACRO_ARG_CNT) return false;
+				var = VarAliasTarget(var);
+				if (!RuleVarIsRegister(var)) return false;
+				regs[count++] = var;
+			}
+			o = (o->mode == INSTR_TUPLE) ? o->var : NULL;
+		}
+	} else {
+		return false;
+	}
+	*p_count = count;
+	return true;
+}
+
+static Bool RuleArgMayMatchShape(RuleArg * pattern, ArgShapeMode mode, Bool is_const, Bool is_reg)
+/*
+Purpose:
+	Test, whether the pattern may match argument of specified shape.
+	This must be true for every argument matched by ArgMatch.
+*/
+{
+	switch(pattern->variant) {
+	case RULE_ADD:      return mode == SHAPE_VAR || mode == SHAPE_INT || mode == SHAPE_ADD;
+	case RULE_SUB:      return mode == SHAPE_VAR || mode == SHAPE_INT || mode == SHAPE_SUB;
+	case RULE_RANGE:    return mode == SHAPE_RANGE;
+	case RULE_TUPLE:    return mode == SHAPE_TUPLE;
+	case RULE_BYTE:     return mode == SHAPE_BYTE;
+	case RULE_ELEMENT:  return mode == SHAPE_ELEMENT;
+	case RULE_DEREF:    return mode == SHAPE_DEREF;
+	case RULE_CONST:    return is_const;
+	case RULE_REGISTER: return pattern->var == NULL || !VarIsConst(pattern->var) || is_const;
+	case RULE_VARIABLE: return mode == SHAPE_VAR && !is_reg;
+	case RULE_ARG:      return (mode == SHAPE_VAR || mode == SHAPE_BYTE || is_const) && !is_reg;
+	default:            return true;
+	}
+}
+
+static void RuleIndexFree(RuleIndex * index)
+{
+	MemArena arena;
+	if (index != NULL) {
+		arena = index->arena;
+		MemArenaFree(&arena);
+	}
+}
+
+static void RuleArgIndexAddReg(RuleIndex * index, RuleArgIndex * ai, Var * reg, UInt32 rule_no)
+{
+	UInt32 n;
+	for(n = 0; n < ai->reg_count; n++) {
+		if (ai->regs[n].reg == reg) break;
+	}
+	if (n == ai->reg_count) {
+		ai->regs[n].reg = reg;
+		ai->regs[n].rules = LiveSetAlloc(&index->arena, index->count);
+		ai->reg_count++;
+	}
+	LiveSetInclude(ai->regs[n].rules, rule_no);
+}
+
+static RuleIndex * RuleIndexBuild(Rule * rules)
+{
+	MemArena arena;
+	RuleIndex * index;
+	RuleArgIndex * ai;
+	RuleArg * pattern;
+	Rule * rule;
+	Var * regs[MACRO_ARG_CNT];
+	UInt32 count, n, reg_count, k;
+	UInt32 reg_refs[3];
+	UInt8 a, m, c, r;
+
+	// Count rules and register references (there can not be more different registers than references)
+
+	count = 0;
+	reg_refs[0] = reg_refs[1] = reg_refs[2] = 0;
+	for(rule = rules; rule != NULL; rule = rule->next) {
+		count++;
+		for(a = 0; a < 3; a++) {
+			if (RuleArgRegisters(&rule->arg[a], regs, &reg_count)) reg_refs[a] += reg_count;
+		}
+	}
+
+	MemArenaInit(&arena, 0);
+	index = MemArenaAllocStruct(&arena, RuleIndex);
+	index->count = count;
+	index->rules = (Rule **)MemArenaAlloc(&arena, sizeof(Rule *) * count);
+	index->candidates = LiveSetAlloc(&arena, count);
+	index->arg_rules  = LiveSetAlloc(&arena, count);
+
+	for(a = 0; a < 3; a++) {
+		ai = &index->arg[a];
+		for(k = 0; k < SHAPE_CNT; k++) {
+			ai->shape[k] = LiveSetAlloc(&arena, count);
+		}
+		ai->regs = (RuleRegIndex *)MemArenaAlloc(&arena, sizeof(RuleRegIndex) * (reg_refs[a] + 1));
+		ai->reg_count = 0;
+	}
+
+	// From now on, the arena is owned by the index
+	index->arena = arena;
+
+	for(rule = rules, n = 0; rule != NULL; rule = rule->next, n++) {
+		index->rules[n] = rule;
+		for(a = 0; a < 3; a++) {
+			ai = &index->arg[a];
+			pattern = &rule->arg[a];
+
+			// Only RULE_ANY matches missing argument
+			if (pattern->variant == RULE_ANY) {
+				LiveSetInclude(ai->shape[SHAPE_NULL], n);
+			}
+
+			if (RuleArgRegisters(pattern, regs, &reg_count)) {
+				for(k = 0; k < reg_count; k++) {
+					RuleArgIndexAddReg(index, ai, regs[k], n);
+				}
+			} else {
+				for(m = 0; m < SHAPE_MODE_CNT; m++) {
+					for(c = 0; c < 2; c++) {
+						for(r = 0; r < 2; r++) {
+							if (RuleArgMayMatchShape(pattern, m, c, r)) {
+								LiveSetInclude(ai->shape[ArgShape(m, c, r)], n);
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	return index;
+}
+
+static LiveSet RuleArgIndexRules(RuleIndex * index, RuleArgIndex * ai, Var * arg)
+/*
+Purpose:
+	Return set of rules that may match the argument.
+*/
+{
+	LiveSet shape;
+	Var * reg;
+	UInt32 n;
+
+	shape = ai->shape[VarShape(arg)];
+	if (arg != NULL && ai->reg_count > 0) {
+		reg = VarAliasTarget(arg);
+		for(n = 0; n < ai->reg_count; n++) {
+			if (ai->regs[n].reg == reg) {
+				LiveSetCopy(index->arg_rules, shape, index->count);
+				LiveSetUnion(index->arg_rules, ai->regs[n].rules, index->count);
+				return index->arg_rules;
+			}
+		}
+	}
+	return shape;
+}
+
+static Rule * RuleSetMatchIndex(RuleSet * ruleset, Instr * i, CompilerPhase match_mode)
+/*
+Purpose:
+	Find the first (most specific) rule matching the instruction using the rule index.
+*/
+{
+	RuleIndex * index;
+	UInt32 count, n;
+
+	index = ruleset->index[i->op];
+	if (index == NULL) {
+		if (ruleset->rules[i->op] == NULL) return NULL;
+		index = RuleIndexBuild(ruleset->rules[i->op]);
+		ruleset->index[i->op] = index;
+	}
+
+	count = index->count;
+	LiveSetCopy(index->candidates, RuleArgIndexRules(index, &index->arg[0], i->result), count);
+	LiveSetIntersect(index->candidates, RuleArgIndexRules(index, &index->arg[1], i->arg1), count);
+	LiveSetIntersect(index->candidates, RuleArgIndexRules(index, &index->arg[2], i->arg2), count);
+
+	FOR_EACH_LIVE(index->candidates, count, n)
+		if (RuleMatch(index->rules[n], i, match_mode)) return index->rules[n];
+	NEXT_LIVE
+	return NULL;
+}
+
+/***********************************************
+
+  Rule cache
+
+************************************************/
+
+/*
+Optimizer asks for the rule for the same instruction again and again.
+Result of the rule lookup (including failure) is therefore remembered in the cache.
+
+Cache key is the rule set, operation, match mode and signature of all three arguments.
+Argument signature contains the variable, it's mode, submode, type and value and (recursively) signatures
+of variables it refers to (address, array, index, etc.), so a change of any of these results in different key.
+Instructions with arguments too complex to fit the key are not cached.
+
+Types are not changed in place after parsing (new type is allocated instead), so the type pointer in key
+identifies the type. The cache is used only after the parsing has been finished and it is invalidated
+when a rule is registered or types are garbage collected.
+*/
+
+#define RULE_CACHE_SIZE    2048		// number of entries in the cache (must be power of two)
+#define RULE_CACHE_KEY_MAX 48		// maximal number of words in the key
+#define RULE_CACHE_DEPTH   8		// maximal depth of referenced variables in the signature
+
+typedef struct {
+	UInt32 len;
+	UInt64 w[RULE_CACHE_KEY_MAX];
+} RuleCacheKey;
+
+typedef struct {
+	UInt32 epoch;				// entry is valid, only if it's epoch is current epoch of the cache
+	Rule * rule;				// found rule (NULL if there is no rule for the instruction)
+	RuleCacheKey key;
+} RuleCacheEntry;
+
+GLOBAL RuleCacheEntry * RULE_CACHE;
+GLOBAL UInt32 RULE_CACHE_EPOCH;
+GLOBAL UInt32 RULE_CACHE_HITS;
+GLOBAL UInt32 RULE_CACHE_MISSES;
+
+void RuleCacheInvalidate()
+{
+	RULE_CACHE_EPOCH++;
+}
+
+void RuleCachePrintStats()
+{
+	Print("Rule cache: "); PrintInt(RULE_CACHE_HITS); Print(" hits, "); PrintInt(RULE_CACHE_MISSES); Print(" misses\n");
+}
+
+static Bool VarRefersToVar(Var * var)
+/*
+Purpose:
+	Return true, if the var member of the variable is another variable.
+*/
+{
+	switch(var->mode) {
+	case INSTR_ELEMENT:
+	case INSTR_BYTE:
+	case INSTR_BIT:
+	case INSTR_TUPLE:
+	case INSTR_RANGE:
+	case INSTR_DEREF:
+	case INSTR_ADD:
+	case INSTR_SUB:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static Bool RuleCacheKeyAdd(RuleCacheKey * key, UInt64 w)
+{
+	if (key->len == RULE_CACHE_KEY_MAX) return false;
+	key->w[key->len++] = w;
+	return true;
+}
+
+static Bool RuleCacheKeyAddVar(RuleCacheKey * key, Var * var, UInt8 depth)
+/*
+Purpose:
+	Add signature of the variable to the key.
+	Return false, if the signature does not fit into the key.
+*/
+{
+	UInt64 value;
+
+	if (var == NULL) return RuleCacheKeyAdd(key, 0);
+	if (depth == 0) return false;
+
+	if (var->mode == INSTR_INT) {
+		value = (UInt64)var->n;
+	} else {
+		value = (UInt64)(size_t)var->var;
+	}
+
+	if (!RuleCacheKeyAdd(key, (UInt64)(size_t)var)) return false;
+	if (!RuleCacheKeyAdd(key, (UInt64)var->mode | ((UInt64)var->submode << 16))) return false;
+	if (!RuleCacheKeyAdd(key, (UInt64)(size_t)var->type)) return false;
+	if (!RuleCacheKeyAdd(key, value)) return false;
+	if (!RuleCacheKeyAddVar(key, var->adr, depth - 1)) return false;
+	if (VarRefersToVar(var)) {
+		if (!RuleCacheKeyAddVar(key, var->var, depth - 1)) return false;
+	}
+	return true;
+}
+
+static UInt32 RuleCacheKeyHash(RuleCacheKey * key)
+{
+	UInt64 h = 14695981039346656037ULL;
+	UInt32 n;
+	for(n = 0; n < key->len; n++) {
+		h = (h ^ key->w[n]) * 1099511628211ULL;
+		h ^= h >> 29;
+	}
+	return (UInt32)(h ^ (h >> 32));
+}
+
+static Bool RuleCacheKeyEqual(RuleCacheKey * l, RuleCacheKey * r)
+{
+	UInt32 n;
+	if (l->len != r->len) return false;
+	for(n = 0; n < l->len; n++) {
+		if (l->w[n] != r->w[n]) return false;
+	}
+	return true;
+}
+
+static Rule * RuleCacheMatch(RuleSet * ruleset, Instr * i, CompilerPhase match_mode)
+/*
+Purpose:
+	Find the first (most specific) rule matching the instruction.
+	Use the cache, if possible.
+*/
+{
+	RuleCacheKey key;
+	RuleCacheEntry * entry;
+	Rule * rule;
+
+	// Types may be modified while parsing, so we do not use cache in that phase
+	if (PHASE == PHASE_PARSE) return RuleSetMatchIndex(ruleset, i, match_mode);
+
+	key.len = 0;
+	RuleCacheKeyAdd(&key, (UInt64)(size_t)ruleset);
+	RuleCacheKeyAdd(&key, (UInt64)i->op | ((UInt64)match_mode << 16));
+	if (!RuleCacheKeyAddVar(&key, i->result, RULE_CACHE_DEPTH)
+	 || !RuleCacheKeyAddVar(&key, i->arg1, RULE_CACHE_DEPTH)
+	 || !RuleCacheKeyAddVar(&key, i->arg2, RULE_CACHE_DEPTH)) {
+		RULE_CACHE_MISSES++;
+		return RuleSetMatchIndex(ruleset, i, match_mode);
+	}
+
+	if (RULE_CACHE == NULL) {
+		RULE_CACHE = (RuleCacheEntry *)MemAllocEmpty(sizeof(RuleCacheEntry) * RULE_CACHE_SIZE);
+		RULE_CACHE_EPOCH++;
+	}
+
+	entry = &RULE_CACHE[RuleCacheKeyHash(&key) & (RULE_CACHE_SIZE - 1)];
+	if (entry->epoch == RULE_CACHE_EPOCH && RuleCacheKeyEqual(&entry->key, &key)) {
+		RULE_CACHE_HITS++;
+		rule = entry->rule;
+
+		// Matching the rule sets the macro arguments
+		if (rule != NULL) RuleMatch(rule, i, match_mode);
+		return rule;
+	}
+
+	RULE_CACHE_MISSES++;
+	rule = RuleSetMatchIndex(ruleset, i, match_mode);
+
+	entry->epoch = RULE_CACHE_EPOCH;
+	entry->rule  = rule;
+	entry->key.len = key.len;
+	MemMove(entry->key.w, key.w, key.len * sizeof(UInt64));
+	return rule;
+}
+
+static Rule * RuleSetMatch(RuleSet * ruleset, Instr * i, CompilerPhase match_mode)
+/*
+Purpose:
+	Find the first (most specific) rule matching the instruction.
+*/
+{
+	Rule * rule = RuleCacheMatch(ruleset, i, match_mode);
+	RULE_STATS.lookups[i->op]++;
+	if (rule != NULL) RULE_STATS.found[i->op]++;
+	return rule;
+}
+
 Rule * RuleSetFindRule(RuleSet * ruleset, InstrOp op, Var * result, Var * arg1, Var * arg2)
 /*
 Purpose:
@@ -466,16 +1164,10 @@ Purpose:
 */
 {
 	Instr i;
-	Rule * rule;
-	
-	rule = ruleset->rules[op];
-	if (op == INSTR_LINE) return rule;
+	if (op == INSTR_LINE) return ruleset->rules[op];
 
 	i.op = op; i.result = result; i.arg1 = arg1; i.arg2 = arg2;
-	for(; rule != NULL; rule = rule->next) {
-		if (RuleMatch(rule, &i, PHASE_TRANSLATE)) break;
-	}
-	return rule;
+	return RuleSetMatch(ruleset, &i, PHASE_TRANSLATE);
 }
 
 
@@ -486,18 +1178,8 @@ Purpose:
 	May be used to test, whether specified instruction may be emitted or not.
 */
 {
-	Rule * rule;
-	
-	rule = INSTR_RULES.rules[instr->op];
-	if (instr->op == INSTR_LINE) return rule;
-
-	for(; rule != NULL; rule = rule->next) {
-		if (RuleMatch(rule, instr, PHASE_EMIT)) {		
-			break;
-		}
-	}
-
-	return rule;
+	if (instr->op == INSTR_LINE) return INSTR_RULES.rules[INSTR_LINE];
+	return RuleSetMatch(&INSTR_RULES, instr, PHASE_EMIT);
 }
 
 Rule * InstrRule2(InstrOp op, Var * result, Var * arg1, Var * arg2)
@@ -513,23 +1195,18 @@ Rule * InstrRule2(InstrOp op, Var * result, Var * arg1, Var * arg2)
 Rule * TranslateRule(InstrOp op, Var * result, Var * arg1, Var * arg2)
 {
 	Instr i;
-	Rule * rule;
 	i.op = op;
 	i.result = result;
 	i.arg1 = arg1;
 	i.arg2 = arg2;
-	for(rule = TRANSLATE_RULES.rules[op]; rule != NULL; rule = rule->next) {
-		if (RuleMatch(rule, &i, PHASE_TRANSLATE)) {
-			return rule;
-		}
-	}
-	return NULL;
+	return RuleSetMatch(&TRANSLATE_RULES, &i, PHASE_TRANSLATE);
 }
 
 void GenMatchedRule(Rule * rule)
 {
 	Var rule_proc;
 	Var * args[MACRO_ARG_CNT];	
+	RULE_STATS.expansions[rule->op]++;
 	rule_proc.instr = rule->to;
 	MemMove(args, MACRO_ARG, sizeof(args));
 	GenMacro(&rule_proc, args);
@@ -608,7 +1285,12 @@ Purpose:
 	return found_type;
 }
 
-Bool InstrTranslate3(InstrOp op, Var * result, Var * arg1, Var * arg2, UInt8 mode)
+static Bool InstrTranslateSplit(InstrOp op, Var * result, Var * arg1, Var * arg2, UInt8 mode)
+/*
+Purpose:
+	Translate the instruction.
+	If it is not possible to translate it directly, split it to more instructions using temporary variables.
+*/
 {
 	Var * a;
 	Var  tmp1,  tmp2,  tmp_r;
@@ -692,6 +1374,7 @@ Bool InstrTranslate3(InstrOp op, Var * result, Var * arg1, Var * arg2, UInt8 mod
 				result_type = result->type; 
 				while((result_type = TypeBiggerType(op, result_type)) != NULL) {			
 					VarInitType(&tmp_r, result_type);
+					RULE_STATS.bigger_result++;
 					if (InstrTranslate3(INSTR_LET, result, &tmp_r, NULL, mode | TEST_ONLY)) {
 						if (InstrTranslate3(op, &tmp_r, arg1, arg2, mode | BIGGER_RESULT | TEST_ONLY)) {
 							has_r = true;
@@ -729,6 +1412,21 @@ found_translation:
 	return true;
 }
 
+Bool InstrTranslate3(InstrOp op, Var * result, Var * arg1, Var * arg2, UInt8 mode)
+{
+	Bool translated;
+
+	RULE_STATS.translations++;
+	if (RULE_STATS.depth < RULE_STATS_DEPTH_CNT) RULE_STATS.depth_cnt[RULE_STATS.depth]++;
+	RULE_STATS.depth++;
+	if (RULE_STATS.depth > RULE_STATS.depth_max) RULE_STATS.depth_max = RULE_STATS.depth;
+
+	translated = InstrTranslateSplit(op, result, arg1, arg2, mode);
+
+	RULE_STATS.depth--;
+	return translated;
+}
+
 extern InstrBlock * BLK;
 
 void ProcTranslate(Var * proc)
@@ -37,7 +37,7 @@ We work with types in a very dynamic way during type inference, so we need the a
 Mark and sweep garbage collector is implemented for types.
 */
 
-#define TYPE_BLOCK_CAPACITY 32
+#define TYPE_BLOCK_CAPACITY 256
 
 typedef struct TypeBlockTag  TypeBlock;
 
@@ -60,7 +60,7 @@ GLOBAL Type *    FREE_TYPE;
 
 void TypeInitBlock(TypeBlock * tb)
 {
-	UInt8 i;
+	UInt16 i;
 	Type * type;
 
 	for(i=0, type = &tb->types[TYPE_BLOCK_CAPACITY-1]; i<TYPE_BLOCK_CAPACITY; i++, type--) {
@@ -111,7 +111,7 @@ void TypeGarbageCollect()
 {
 	Var * var;
 	Type * type;
-	UInt8 i;
+	UInt16 i;
 	TypeBlock * tb;
 
 	// Mark all types as unused
@@ -414,7 +414,7 @@ Purpose:
 	if (type->variant == TYPE_INT) {
 		// Register type of this constant as specified type
 		var->type  = type;
-		var->scope = var->type->owner;
+		VarChangeScope(var, var->type->owner);
 
 		if (var->var == NULL) {
 			if (type->range.flexible) {
@@ -2814,15 +2814,12 @@ Purpose:
 
 	MarkLoops(proc);
 	for(loc.blk = proc->instr; loc.blk != NULL; loc.blk = loc.blk->next) {
-		header = NULL;
-		if (loc.blk->jump_type == JUMP_LOOP) {
-			header = loc.blk->cond_to;
-			if (header == NULL) header = loc.blk->to;
-		}
+		for(header = loc.blk->loop_header; header != NULL; header = header->loop_parent) {
+			if (header->loop_end != loc.blk) continue;
+
+			// This is end of loop.
+			// We may try to infer some information if we know maximal and/or minimal number of repeats
 
-		// This is end of loop.
-		// We may try to infer some information if we know maximal and/or minimal number of repeats
-		if (header != NULL) {
 //			Print("Loop "); PrintInt(header->seq_no); Print(".."); PrintInt(loc.blk->seq_no); PrintEOL();
 			i = LastInstr(loc.blk);
 
@@ -128,9 +128,12 @@ Purpose:
 	Variables from other procedured are not added.
 */
 {
-	Var * var;
+	Var * var, ** locals;
+	UInt32 i, cnt;
 
-	FOR_EACH_LOCAL(proc, var)
+	locals = VarLocals(proc, &cnt);
+	for(i = 0; i < cnt; i++) {
+		var = locals[i];
 		if (var->mode == INSTR_SCOPE) {
 			if (var != CPU->SCOPE) {
 				ProcAddLocalVars(var, set, filter_fn);
@@ -145,7 +148,7 @@ Purpose:
 				}
 			}
 		}
-	NEXT_LOCAL
+	}
 }
 
 void ProcLocalVars(Var * proc, VarSet * set, VarFilter filter_fn)
@@ -4,6 +4,10 @@ Integer constant support
 Integer constants are represented as INSTR_INT cells.
 They are kept in their own private scope.
 
+Every integer value is represented by exactly one cell.
+To find the cell quickly, constants are hashed by their value.
+Small constants (0..INT_CACHE_SIZE-1) are additionally cached in INTS array.
+
 (c) 2010 Rudolf Kudla 
 Licensed under the MIT license: http://www.opensource.org/licenses/mit-license.php
 
@@ -11,15 +15,46 @@ Licensed under the MIT license: http://www.opensource.org/licenses/mit-license.p
 
 #include "language.h"
 
+#define INT_CACHE_SIZE 256
+#define INT_HASH_INITIAL_SIZE 256
+
+// Integer constants are not part of variable index, so they use next_hash[0] as link in INT_HASH bucket.
+#define NEXT_INT(var) (var)->next_hash[0]
+
 GLOBAL Var * ZERO;
 GLOBAL Var * ONE;
-GLOBAL Var * INTS[256];	// 0..255 integer constants (for faster access)
+GLOBAL Var * INTS[INT_CACHE_SIZE];	// 0..255 integer constants (for faster access)
 GLOBAL Var INT_VAR;
 
+GLOBAL Var ** INT_HASH;				// hash of integer constants
+GLOBAL UInt32 INT_HASH_SIZE;		// number of buckets in INT_HASH (power of two)
+GLOBAL UInt32 INT_COUNT;			// number of integer constants
+
+static void IntHashResize(UInt32 size)
+{
+	Var * var, ** bucket;
+
+	MemFree(INT_HASH);
+	INT_HASH = (Var **)MemAllocEmpty(sizeof(Var *) * size);
+	INT_HASH_SIZE = size;
+
+	for(var = INT_VAR.subscope; var != NULL; var = var->next_in_scope) {
+		bucket = &INT_HASH[IntHash(&var->n) & (INT_HASH_SIZE - 1)];
+		NEXT_INT(var) = *bucket;
+		*bucket = var;
+	}
+}
+
 Var * VarInt(Int32  n)
 {
 	Var * var;
 	BigInt bi;
+
+	if (n >= 0 && n < INT_CACHE_SIZE) {
+		var = INTS[n];
+		if (var != NULL) return var;
+	}
+
 	IntInit(&bi, n);
 	var = VarN(&bi);
 	IntFree(&bi);
@@ -32,36 +67,47 @@ Purpose:
 	Return variable representing integer constant.
 */
 {
-	Var * var;
+	Var * var, ** bucket;
+	Int32 small;
 
-	// Try to find the integer variable in hash
-//	if (n>=0 && n<=255) {
-//		var = INTS[n];
-//		if (var != NULL) return var;
-//	}
+	// Try to find the integer variable in cache of small constants
 
-	// Try to find the integer constant in the scope
+	small = -1;
+	if (!IntLowerN(n, 0) && IntLowerN(n, INT_CACHE_SIZE)) {
+		small = IntN(n);
+		var = INTS[small];
+		if (var != NULL) return var;
+	}
 
-	for(var = INT_VAR.subscope; var != NULL; var = var->next_in_scope) {
+	// Try to find the integer constant in hash
+
+	bucket = &INT_HASH[IntHash(n) & (INT_HASH_SIZE - 1)];
+	for(var = *bucket; var != NULL; var = NEXT_INT(var)) {
 		ASSERT(var->mode == INSTR_INT);
-		if (var->mode == INSTR_INT && IntEq(&var->n, n)) return var;
+		if (IntEq(&var->n, n)) return var;
 	}
 
 	// Constant was not found, create new one
 	var = VarAllocUnused();
 	var->mode =  INSTR_INT;
 	var->scope = NULL;
-//	var->scope = &INT_VAR;
 	VarSetScope(var, &INT_VAR);
 
-//	var = VarAllocScope(&INT_VAR, INSTR_INT, NULL, 0);
 	var->type = &TINT;						// In future, the type of the constant should be the constant itself (self reference)
 	IntSet(&var->n, n);
 
 	// Put the variable into hash
-//	if (n>=0 && n<=255) {
-//		INTS[n] = var;
-//	}
+
+	NEXT_INT(var) = *bucket;
+	*bucket = var;
+	INT_COUNT++;
+	if (INT_COUNT > INT_HASH_SIZE) {
+		IntHashResize(INT_HASH_SIZE * 2);
+	}
+
+	if (small >= 0) {
+		INTS[small] = var;
+	}
 
 	return var;
 }
@@ -70,6 +116,8 @@ void IntConstInit()
 {
 	MemEmpty(&INT_VAR, sizeof(INT_VAR));
 	MemEmpty(&INTS, sizeof(INTS));
+	INT_COUNT = 0;
+	IntHashResize(INT_HASH_INITIAL_SIZE);
 	ZERO = VarInt(0);
 	ONE  = VarInt(1);
 }
@@ -6,31 +6,98 @@ VarSet is collection of variables.
 (c) 2010 Rudolf Kudla 
 Licensed under the MIT license: http://www.opensource.org/licenses/mit-license.php
 
+Items are stored in dense array in the order in which they were added, so they can be accessed by index.
+Index of the item is stored in the key variable (set_index), so it is possible to use it for indexing
+arrays of information related to the set (for example LiveSet).
+
+When the set has contained more than VAR_SET_LINEAR_MAX items, open addressing hash table (with linear probing)
+is used to find the items by key. Hash table contains index of the item + 1 (0 means empty slot).
+
 */
 
 #include "language.h"
 
+#define VAR_SET_LINEAR_MAX 8
+
+static UInt32 VarSetHash(Var * key)
+{
+	return (UInt32)((size_t)key >> 3) * 2654435761UL;
+}
+
 void VarSetInit(VarSet * set)
 {
 	set->count = set->capacity = 0;
 	set->arr   = NULL;
+	set->hash  = NULL;
+	set->hash_size = 0;
 }
 
 void VarSetCleanup(VarSet * set)
 {
 	MemFree(set->arr);
+	MemFree(set->hash);
 	VarSetInit(set);
 }
 
 void VarSetEmpty(VarSet * set)
 {
 	set->count = 0;
+	if (set->hash != NULL) {
+		MemEmpty(set->hash, sizeof(UInt32) * set->hash_size);
+	}
+}
+
+static void VarSetHashInsert(VarSet * set, UInt32 index)
+{
+	UInt32 mask, h;
+	mask = set->hash_size - 1;
+	for(h = VarSetHash(set->arr[index].key) & mask; set->hash[h] != 0; h = (h + 1) & mask);
+	set->hash[h] = index + 1;
+}
+
+static void VarSetRehash(VarSet * set, UInt32 size)
+{
+	UInt32 i;
+	MemFree(set->hash);
+	set->hash = (UInt32 *)MemAllocEmpty(sizeof(UInt32) * size);
+	set->hash_size = size;
+	for(i = 0; i < set->count; i++) {
+		VarSetHashInsert(set, i);
+	}
+}
+
+static Bool VarSetFindSlot(VarSet * set, Var * key, UInt32 * p_slot)
+/*
+Purpose:
+	Find slot in hash table, where item with specified key is stored.
+	If the item is not in the set, return false and the empty slot where the item would be stored.
+*/
+{
+	UInt32 mask, h, idx;
+	mask = set->hash_size - 1;
+	for(h = VarSetHash(key) & mask; (idx = set->hash[h]) != 0; h = (h + 1) & mask) {
+		if (set->arr[idx-1].key == key) {
+			*p_slot = h;
+			return true;
+		}
+	}
+	*p_slot = h;
+	return false;
 }
 
-Bool VarSetFindIndex(VarSet * set, Var * key, UInt16 * p_index)
+Bool VarSetFindIndex(VarSet * set, Var * key, UInt32 * p_index)
 {
 	VarTuple * tuple;
-	UInt16 cnt, i;
+	UInt32 cnt, i, slot;
+
+	if (set->hash != NULL) {
+		if (VarSetFindSlot(set, key, &slot)) {
+			*p_index = set->hash[slot] - 1;
+			return true;
+		}
+		return false;
+	}
+
 	for(cnt = set->count, tuple = set->arr, i = 0; cnt>0; cnt--, tuple++, i++) {
 		if (tuple->key == key) {
 			*p_index = i;
@@ -42,31 +109,65 @@ Bool VarSetFindIndex(VarSet * set, Var * key, UInt16 * p_index)
 
 Var * VarSetFind(VarSet * set, Var * key)
 {
-	UInt16 i;
+	UInt32 i;
 	if (VarSetFindIndex(set, key, &i)) {
 		return set->arr[i].var;
 	}
 	return NULL;
 }
 
+static void VarSetHashRemove(VarSet * set, UInt32 slot)
+/*
+Purpose:
+	Remove item from the hash table slot.
+	Following items in the same cluster are moved back, so the search does not stop on the new empty slot.
+*/
+{
+	UInt32 mask, h, home, idx;
+	mask = set->hash_size - 1;
+	set->hash[slot] = 0;
+	for(h = (slot + 1) & mask; (idx = set->hash[h]) != 0; h = (h + 1) & mask) {
+		home = VarSetHash(set->arr[idx-1].key) & mask;
+		// Item may be moved to the empty slot, if the slot is cyclically between its home slot and its current slot
+		if (((h - home) & mask) >= ((h - slot) & mask)) {
+			set->hash[slot] = idx;
+			set->hash[h] = 0;
+			slot = h;
+		}
+	}
+}
+
 Var * VarSetRemove(VarSet * set, Var * key)
 /*
 Purpose:
 	Remove item with specified key from the set.
 	If the item existed, return it's value, otherwise return NULL.
+	Last item of the set is moved to the place of removed item (it's set_index changes).
 */
 {
 	Var * var;
-	UInt16 i;
-	if (VarSetFindIndex(set, key, &i)) {
-		var = set->arr[i].var;
-		if (i < set->count) {
-			memmove(&set->arr[i], &set->arr[set->count-1], sizeof(VarTuple));
+	UInt32 i, last, slot;
+
+	if (!VarSetFindIndex(set, key, &i)) return NULL;
+
+	var = set->arr[i].var;
+	last = set->count - 1;
+
+	if (set->hash != NULL) {
+		VarSetFindSlot(set, key, &slot);
+		VarSetHashRemove(set, slot);
+		if (i != last) {
+			VarSetFindSlot(set, set->arr[last].key, &slot);
+			set->hash[slot] = i + 1;
 		}
-		set->count--;
-		return var;
 	}
-	return NULL;
+
+	if (i != last) {
+		set->arr[i] = set->arr[last];
+		set->arr[i].key->set_index = i;
+	}
+	set->count--;
+	return var;
 }
 
 void VarSetAdd(VarSet * set, Var * key, Var * var)
@@ -76,7 +177,7 @@ Purpose:
 	If the item with given key already exists in the collection, just set it's var to new value.
 */
 {
-	UInt16 new_capacity, i;
+	UInt32 new_capacity, i;
 	VarTuple * tuple;
 
 	if (!VarSetFindIndex(set, key, &i)) {
@@ -92,12 +193,22 @@ Purpose:
 		tuple->var = var;
 		key->set_index = set->count;
 		set->count++;
+
+		// Hash table is kept at most half full
+
+		if (set->hash != NULL || set->count > VAR_SET_LINEAR_MAX) {
+			if (set->count * 2 > set->hash_size) {
+				VarSetRehash(set, set->hash_size == 0 ? VAR_SET_LINEAR_MAX * 4 : set->hash_size * 2);
+			} else {
+				VarSetHashInsert(set, set->count - 1);
+			}
+		}
 	} else {
 		set->arr[i].var = var;
 	}
 }
 
-VarTuple * VarSetItem(VarSet * set, UInt16 index)
+VarTuple * VarSetItem(VarSet * set, UInt32 index)
 {
 	return &set->arr[index];
 }
@@ -105,7 +216,7 @@ VarTuple * VarSetItem(VarSet * set, UInt16 index)
 void VarSetPrint(VarSet * set)
 {
 	VarTuple * tuple;
-	UInt16 cnt, i;
+	UInt32 cnt, i;
 	for(cnt = set->count, tuple = set->arr, i = 0; cnt>0; cnt--, tuple++, i++) {
 		PrintVar(tuple->key);
 		PrintEOL();
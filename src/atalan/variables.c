@@ -9,6 +9,7 @@ Licensed under the MIT license: http://www.opensource.org/licenses/mit-license.p
 */
 
 #include "language.h"
+#include <ctype.h>
 
 GLOBAL Var * UNUSED_VARS;		    // scope in which are all the free variables
 GLOBAL VarBlock * VAR_BLOCKS;       // list of all variable blocks
@@ -16,6 +17,7 @@ GLOBAL VarBlock * LAST_VAR_BLOCK;   // list of all variable blocks
 
 GLOBAL Var * VARS;		// global variables
 GLOBAL Var * LAST_VAR;  // Last allocated variable.
+GLOBAL UInt32 VAR_SEQ_NO;	// sequence number of last variable added to VARS
 
 GLOBAL Var * SCOPE;		// current scope
 GLOBAL UInt32 TMP_IDX;
@@ -25,6 +27,7 @@ GLOBAL UInt32 TMP_LBL_IDX;
 GLOBAL char VAR_NAME[128];
 
 void IntConstInit();
+static Var * VarAllocScopeName(Var * scope, InstrOp mode, char * name, VarIdx idx);
 
 
 /*
@@ -35,8 +38,43 @@ Current CPU used is stored in CPU variable.
 CPUType CPUS[1];			// currently, there is only one supported CPU
 GLOBAL CPUType * CPU;		// current CPU (in case we use multiple CPUs in the future)
 
-char * TMP_NAME = "_";
-char * TMP_LBL_NAME = "_lbl";
+/*
+Variable index
+==============
+
+Variables in VARS chain are indexed using hash tables, so we do not have to walk whole chain when searching
+for a variable by name or when looking for an existing variable derived from other variables.
+
+VAR_INDEX_SCOPE	 (scope, name, idx)	used by VarFindScope
+VAR_INDEX_NAME	 (name, idx)		used by VarFind and VarFindTypeVariant
+VAR_INDEX_OP	 (mode, adr, var)	used by VarFindOp (only variables registered using VarSetOpArgs)
+
+Variable names are interned (see names.c), so the hash is computed from the name key pointer and names
+are compared as pointers. Name used for lookup must be converted to name key using NameFind first.
+Variables in every bucket are sorted by their sequence number, so the first matching variable in bucket is
+the same variable we would find by walking the VARS chain.
+Last variable of every bucket is remembered, so newly allocated variables (which have the highest sequence number)
+are appended without walking the bucket. This matters for anonymous variables, which all share one bucket.
+Integer constants are not in VARS chain and they are not indexed.
+*/
+
+#define VAR_INDEX_SCOPE 0
+#define VAR_INDEX_NAME  1
+#define VAR_INDEX_OP    2
+#define VAR_INDEX_INITIAL_SIZE 1024
+
+typedef struct {
+	Var ** bucket;
+	Var ** last;		// last variable in every bucket
+	UInt32 size;		// number of buckets (always power of two)
+} VarIndex;
+
+GLOBAL VarIndex VAR_INDEX[3];
+GLOBAL UInt32 VAR_INDEX_COUNT;		// number of variables indexed by name
+GLOBAL UInt32 VAR_OP_INDEX_COUNT;	// number of variables indexed by operation
+
+char * TMP_NAME;
+char * TMP_LBL_NAME;
 char * SCOPE_NAME = "_s";
 UInt32 SCOPE_IDX;
 
@@ -78,12 +116,163 @@ Var * VarAllocUnused()
 	return var;
 }
 
+static UInt32 VarIndexHash(UInt8 index, Var * scope, char * name, VarIdx idx)
+{
+	UInt32 h;
+	h = (UInt32)((size_t)name >> 3) * 2246822519UL;
+	h = h * 33 + idx;
+	if (index == VAR_INDEX_SCOPE) {
+		h ^= (UInt32)((size_t)scope >> 3) * 2654435761UL;
+	}
+	return h;
+}
+
+static UInt32 VarOpHash(InstrOp op, Var * left, Var * right)
+{
+	UInt32 h;
+	h = (UInt32)op * 2654435761UL;
+	h ^= (UInt32)((size_t)left >> 3) * 40503UL;
+	h = (h << 7 | h >> 25) ^ (UInt32)((size_t)right >> 3) * 2246822519UL;
+	return h;
+}
+
+static UInt32 VarIndexBucket(UInt8 index, Var * var)
+{
+	VarIndex * vi = &VAR_INDEX[index];
+	UInt32 h;
+	if (index == VAR_INDEX_OP) {
+		h = VarOpHash(var->mode, var->adr, var->var);
+	} else {
+		h = VarIndexHash(index, var->scope, NameKey(var->name), var->idx);
+	}
+	return h & (vi->size - 1);
+}
+
+static void VarIndexLink(UInt8 index, Var * var)
+/*
+Purpose:
+	Insert the variable to the index.
+	Variables in the bucket are kept sorted by sequence number.
+*/
+{
+	VarIndex * vi = &VAR_INDEX[index];
+	UInt32 b = VarIndexBucket(index, var);
+	Var ** p;
+	Var * last = vi->last[b];
+
+	if (last == NULL || last->seq_no < var->seq_no) {
+		p = (last == NULL) ? &vi->bucket[b] : &last->next_hash[index];
+		vi->last[b] = var;
+	} else {
+		p = &vi->bucket[b];
+		while((*p)->seq_no < var->seq_no) p = &(*p)->next_hash[index];
+	}
+	var->next_hash[index] = *p;
+	*p = var;
+}
+
+static void VarIndexUnlink(UInt8 index, Var * var)
+{
+	VarIndex * vi = &VAR_INDEX[index];
+	UInt32 b = VarIndexBucket(index, var);
+	Var ** p = &vi->bucket[b];
+	Var * prev = NULL;
+	while(*p != NULL) {
+		if (*p == var) {
+			*p = var->next_hash[index];
+			if (vi->last[b] == var) vi->last[b] = prev;
+			break;
+		}
+		prev = *p;
+		p = &(*p)->next_hash[index];
+	}
+	var->next_hash[index] = NULL;
+}
+
+static void VarIndexAllocBuckets(VarIndex * vi, UInt32 size)
+{
+	vi->bucket = (Var **)MemAllocEmpty(sizeof(Var *) * size);
+	vi->last   = (Var **)MemAllocEmpty(sizeof(Var *) * size);
+	vi->size   = size;
+}
+
+static void VarIndexFreeBuckets(VarIndex * vi)
+{
+	MemFree(vi->bucket);
+	MemFree(vi->last);
+}
+
+static void VarIndexResize(UInt32 size)
+{
+	Var * var;
+	UInt8 index;
+
+	for(index = 0; index < 2; index++) {
+		VarIndexFreeBuckets(&VAR_INDEX[index]);
+		VarIndexAllocBuckets(&VAR_INDEX[index], size);
+	}
+
+	// VARS chain is sorted by sequence number, so the variables are always appended at the end of bucket
+
+	FOR_EACH_VAR(var)
+		VarIndexLink(VAR_INDEX_SCOPE, var);
+		VarIndexLink(VAR_INDEX_NAME, var);
+	NEXT_VAR
+}
+
+static void VarOpIndexResize(UInt32 size)
+/*
+Purpose:
+	Change number of buckets in operation index.
+	Variables are moved from old buckets to new ones.
+*/
+{
+	VarIndex old;
+	Var * var, * next;
+	UInt32 b;
+
+	old = VAR_INDEX[VAR_INDEX_OP];
+	VarIndexAllocBuckets(&VAR_INDEX[VAR_INDEX_OP], size);
+
+	for(b = 0; b < old.size; b++) {
+		for(var = old.bucket[b]; var != NULL; var = next) {
+			next = var->next_hash[VAR_INDEX_OP];
+			VarIndexLink(VAR_INDEX_OP, var);
+		}
+	}
+	VarIndexFreeBuckets(&old);
+}
+
+static void VarIndexAdd(Var * var)
+{
+	VAR_INDEX_COUNT++;
+	if (VAR_INDEX_COUNT > VAR_INDEX[VAR_INDEX_SCOPE].size) {
+		VarIndexResize(VAR_INDEX[VAR_INDEX_SCOPE].size * 2);
+	} else {
+		VarIndexLink(VAR_INDEX_SCOPE, var);
+		VarIndexLink(VAR_INDEX_NAME, var);
+	}
+}
+
 void VarInit()
 {
 
 	VARS = NULL;
 	LAST_VAR = NULL;
+	VAR_SEQ_NO = 0;
+
+	VAR_INDEX_COUNT = 0;
+	VarIndexResize(VAR_INDEX_INITIAL_SIZE);
+
+	VAR_OP_INDEX_COUNT = 0;
+	VarIndexFreeBuckets(&VAR_INDEX[VAR_INDEX_OP]);
+	VAR_INDEX[VAR_INDEX_OP].bucket = NULL;
+	VAR_INDEX[VAR_INDEX_OP].last = NULL;
+	VAR_INDEX[VAR_INDEX_OP].size = 0;
+	VarOpIndexResize(VAR_INDEX_INITIAL_SIZE);
 
+	TMP_NAME = NameUnique("_");
+	TMP_LBL_NAME = NameUnique("_lbl");
 	TMP_IDX = 1;
 	TMP_LBL_IDX = 0;
 	SCOPE_IDX = 0;
@@ -99,10 +288,77 @@ void VarInit()
 
 }
 
-void VarSetScope(Var * var, Var * scope)
+static void ScopeLocalsChanged(Var * scope)
+/*
+Purpose:
+	Discard array of local variables built by VarLocals, as the list of variables in the scope has changed.
+*/
+{
+	if (scope->locals != NULL) {
+		MemFree(scope->locals);
+		scope->locals = NULL;
+	}
+}
+
+static void ScopeRemove(Var * scope, Var * var)
+/*
+Purpose:
+	Remove the variable from list of variables in the scope.
+*/
+{
+	Var * sub, * prev;
+
+	prev = NULL;
+	for(sub = scope->subscope; sub != NULL; prev = sub, sub = sub->next_in_scope) {
+		if (sub == var) {
+			if (prev == NULL) {
+				scope->subscope = var->next_in_scope;
+			} else {
+				prev->next_in_scope = var->next_in_scope;
+			}
+			if (scope->last_subscope == var) scope->last_subscope = prev;
+			scope->subscope_count--;
+			var->next_in_scope = NULL;
+			ScopeLocalsChanged(scope);
+			break;
+		}
+	}
+}
+
+static void ScopeInsert(Var * scope, Var * var)
+/*
+Purpose:
+	Insert the variable to list of variables in the scope.
+	Variables in the scope are kept in the order of VARS chain (sorted by sequence number).
+	Usually, the variable is the last one, so it is just appended.
+*/
 {
-	Var * sub;
+	Var * sub, * prev;
 
+	if (scope->last_subscope == NULL || scope->last_subscope->seq_no < var->seq_no || var->seq_no == 0) {
+		var->next_in_scope = NULL;
+		if (scope->last_subscope == NULL) {
+			scope->subscope = var;
+		} else {
+			scope->last_subscope->next_in_scope = var;
+		}
+		scope->last_subscope = var;
+	} else {
+		prev = NULL;
+		for(sub = scope->subscope; sub->seq_no < var->seq_no; prev = sub, sub = sub->next_in_scope);
+		var->next_in_scope = sub;
+		if (prev == NULL) {
+			scope->subscope = var;
+		} else {
+			prev->next_in_scope = var;
+		}
+	}
+	scope->subscope_count++;
+	ScopeLocalsChanged(scope);
+}
+
+void VarSetScope(Var * var, Var * scope)
+{
 	if (var->scope != NULL) {
 		InternalError("Variable already has the scope set");
 	}
@@ -111,31 +367,53 @@ void VarSetScope(Var * var, Var * scope)
 
 	if (scope == NULL) return;
 
-	//==== Append as last variable in scope
+	ScopeInsert(scope, var);
+}
 
-	if (scope->subscope == NULL) {
-		scope->subscope = var;
-	} else {
-		// We append the variable as last variable in the scope.
-		for(sub = scope->subscope; sub->next_in_scope != NULL;) {
-			sub = sub->next_in_scope;
-		}
-		sub->next_in_scope = var;
-	}
+void VarChangeScope(Var * var, Var * scope)
+/*
+Purpose:
+	Move the variable, that has already been added to chain of variables, to different scope.
+*/
+{
+	if (var->scope == scope) return;
+
+	// Variables not in the chain (integer constants) are not indexed
+	if (var->seq_no != 0) VarIndexUnlink(VAR_INDEX_SCOPE, var);
 
+	if (var->scope != NULL) ScopeRemove(var->scope, var);
+	var->scope = scope;
+	if (scope != NULL) ScopeInsert(scope, var);
 
+	if (var->seq_no != 0) VarIndexLink(VAR_INDEX_SCOPE, var);
+}
+
+void VarSetOpArgs(Var * var, Var * left, Var * right)
+/*
+Purpose:
+	Set arguments of variable created as combination of two other variables (array element, byte, tuple, ...).
+	The variable is registered in operation index, so VarFindOp can find it.
+	Mode of the variable must be already set.
+*/
+{
+	var->adr = left;
+	var->var = right;
+	VarIndexLink(VAR_INDEX_OP, var);
+	VAR_OP_INDEX_COUNT++;
+	if (VAR_OP_INDEX_COUNT > VAR_INDEX[VAR_INDEX_OP].size) {
+		VarOpIndexResize(VAR_INDEX[VAR_INDEX_OP].size * 2);
+	}
 }
 
 Var * VarFindOp(InstrOp op, Var * left, Var * right)
 /*
 Purpose:
 	Find variable created as combination of two other variables.
-Argument:
-	ref		Array is accessed using reference.
 */
 {
 	Var * var;
-	for (var = VARS; var != NULL; var = var->next) {
+	UInt32 h = VarOpHash(op, left, right);
+	for (var = VAR_INDEX[VAR_INDEX_OP].bucket[h & (VAR_INDEX[VAR_INDEX_OP].size - 1)]; var != NULL; var = var->next_hash[VAR_INDEX_OP]) {
 		if (var->mode == op && var->adr == left && var->var == right) return var;
 	}
 	return NULL;
@@ -164,8 +442,7 @@ Purpose:
 	if (var == NULL) {
 		var = VarAllocScope(NO_SCOPE, INSTR_TUPLE, NULL, 0);
 		var->type = TypeTuple(left->type, right->type);
-		var->adr = left;
-		var->var = right;
+		VarSetOpArgs(var, left, right);
 	}
 	return var;
 }
@@ -173,12 +450,13 @@ Purpose:
 Var * VarNewDeref(Var * adr)
 {
 	Var * var;
-	for (var = VARS; var != NULL; var = var->next) {
-		if (var->mode == INSTR_DEREF && var->var == adr) return var;
-	}
+
+	// Dereference variables do not use adr, so it is always NULL
+	var = VarFindOp(INSTR_DEREF, NULL, adr);
+	if (var != NULL) return var;
 
 	var = VarAlloc(INSTR_DEREF, NULL, 0);
-	var->var = adr;
+	VarSetOpArgs(var, NULL, adr);
 	if (adr->type != NULL && adr->type->variant == TYPE_ADR) {
 		var->type = adr->type->element;
 	}
@@ -207,16 +485,10 @@ Argument:
 
 	Var * var = VarFindOp(op, arr, idx);
 	if (var != NULL) return var;
-/*
-	for (var = VARS; var != NULL; var = var->next) {
-		if (var->mode == op) {
-			if (var->adr == arr && var->var == idx) return var;
-		}
-	}
-*/
+
 	item = VarAlloc(op, NULL, 0);
 //	if (ref) item->submode = SUBMODE_REF;
-	item->adr  = arr;
+	VarSetOpArgs(item, arr, idx);
 
 	// Type of array element variable is type of array element
 	// We may attempt to address individual bytes of non-array variable as an aray
@@ -232,7 +504,6 @@ Argument:
 		}
 	} else {
 	}
-	item->var  = idx;
 	// If this is element from in or out variable, it is in or out too
 	item->submode |= (arr->submode & (SUBMODE_IN|SUBMODE_OUT|SUBMODE_REG));
 	return item;
@@ -355,15 +626,12 @@ Var * FindOrAllocLabel(char * name, UInt16 idx)
 {
 	Var * var = NULL;
 	Var * proc;
-	Var * scope;
 
 	proc = VarProcScope();
 	var = VarFindScope(proc, name, idx);
 	if (var == NULL) {
-		scope = InScope(proc);
-		var = VarNewLabel(name);
-		var->idx = idx;
-		ReturnScope(scope);
+		var = VarAllocScope(proc, INSTR_VAR, name, idx);
+		var->type = &TLBL;
 	}
 	return var;
 }
@@ -379,13 +647,17 @@ Var * VarNewTmpLabel()
 {
 	Var * var;
 	TMP_LBL_IDX++;
-	var = VarNewLabel(NULL);
-	var->name = TMP_LBL_NAME;
-	var->idx  = TMP_LBL_IDX;
+	var = VarAllocScopeName(SCOPE, INSTR_VAR, TMP_LBL_NAME, TMP_LBL_IDX);
+	var->type = &TLBL;
 	return var;
 }
 
-Var * VarAllocScope(Var * scope, InstrOp mode, char * name, VarIdx idx)
+static Var * VarAllocScopeName(Var * scope, InstrOp mode, char * name, VarIdx idx)
+/*
+Purpose:
+	Alloc new variable and append it to the chain of variables.
+	Name is used as is (it is not copied).
+*/
 {
 	Var * var;
 
@@ -397,7 +669,7 @@ Var * VarAllocScope(Var * scope, InstrOp mode, char * name, VarIdx idx)
 	var = VarAllocUnused();
 
 	var->mode  = mode;
-	var->name  = StrAlloc(name);
+	var->name  = name;
 	var->idx   = idx;
 	var->adr   = NULL;
 	var->next  = NULL;
@@ -411,8 +683,16 @@ Var * VarAllocScope(Var * scope, InstrOp mode, char * name, VarIdx idx)
 		LAST_VAR->next = var;
 	}
 	LAST_VAR = var;
+	var->seq_no = ++VAR_SEQ_NO;
+
+	VarIndexAdd(var);
+
 	return var;
+}
 
+Var * VarAllocScope(Var * scope, InstrOp mode, char * name, VarIdx idx)
+{
+	return VarAllocScopeName(scope, mode, NameAtom(name), idx);
 }
 
 Var * VarAllocScopeTmp(Var * scope, InstrOp mode, Type * type)
@@ -422,9 +702,7 @@ Purpose:
 */
 {
 	Var * var;
-	var = VarAllocScope(scope, mode, NULL, 0);
-	var->name = TMP_NAME;
-	var->idx = TMP_IDX;
+	var = VarAllocScopeName(scope, mode, TMP_NAME, TMP_IDX);
 	if (type == NULL) type = TUNDEFINED;
 	var->type = type;
 	TMP_IDX++;
@@ -459,9 +737,16 @@ Purpose:
 */
 {
 	Var * var;
-	for (var = VARS; var != NULL; var = var->next) {
+	UInt32 h;
+	char * key;
+
+	key = NameFind(name);
+	if (key == NULL && name != NULL) return NULL;
+
+	h = VarIndexHash(VAR_INDEX_SCOPE, scope, key, idx);
+	for (var = VAR_INDEX[VAR_INDEX_SCOPE].bucket[h & (VAR_INDEX[VAR_INDEX_SCOPE].size - 1)]; var != NULL; var = var->next_hash[VAR_INDEX_SCOPE]) {
 		if (var->scope == scope && var->mode != INSTR_VOID) {
-			if (var->idx == idx && StrEqual(name, var->name)) break;
+			if (var->idx == idx && NameKey(var->name) == key) break;
 		}
 	}
 	return var;
@@ -526,11 +811,26 @@ Var * VarProcScope()
 	return s;
 }
 
+static Var * VarFirstNamed(char * name, VarIdx idx)
+/*
+Purpose:
+	Return first variable in bucket of name index, where variable with specified name may be stored.
+*/
+{
+	UInt32 h = VarIndexHash(VAR_INDEX_NAME, NULL, name, idx);
+	return VAR_INDEX[VAR_INDEX_NAME].bucket[h & (VAR_INDEX[VAR_INDEX_NAME].size - 1)];
+}
+
 Var * VarFind(char * name, VarIdx idx)
 {
 	Var * var;
-	for (var = VARS; var != NULL; var = var->next) {
-		if (var->idx == idx && StrEqual(name, var->name)) break;
+	char * key;
+
+	key = NameFind(name);
+	if (key == NULL && name != NULL) return NULL;
+
+	for (var = VarFirstNamed(key, idx); var != NULL; var = var->next_hash[VAR_INDEX_NAME]) {
+		if (var->idx == idx && NameKey(var->name) == key) break;
 	}
 	return var;
 }
@@ -538,8 +838,13 @@ Var * VarFind(char * name, VarIdx idx)
 Var * VarFindTypeVariant(char * name, VarIdx idx, TypeVariant type_variant)
 {
 	Var * var;
-	for (var = VARS; var != NULL; var = var->next) {
-		if (var->idx == idx && StrEqual(name, var->name) && (type_variant == TYPE_UNDEFINED || (var->type != NULL && var->type->variant == type_variant))) break;
+	char * key;
+
+	key = NameFind(name);
+	if (key == NULL && name != NULL) return NULL;
+
+	for (var = VarFirstNamed(key, idx); var != NULL; var = var->next_hash[VAR_INDEX_NAME]) {
+		if (var->idx == idx && NameKey(var->name) == key && (type_variant == TYPE_UNDEFINED || (var->type != NULL && var->type->variant == type_variant))) break;
 	}
 	return var;
 }
@@ -732,6 +1037,8 @@ void VarResetUse()
 {
 	Var * var;
 
+	VAR_USE_VALID = false;
+
 	FOR_EACH_VAR(var)
 		if (var->type->variant != TYPE_PROC) {
 			var->read = 0;
@@ -1125,17 +1432,47 @@ Bool VarIsLocal(Var * var, Var * scope)
 
 Var * VarNextLocal(Var * scope, Var * local)
 {
-	while(true) {
-		local = local->next;
-		if (local == NULL) break;
-		if (local->scope == scope) break;
+	// Global variables (with NULL scope) are not linked in any list, we must search for them in VARS chain
+	if (scope == NULL) {
+		while(true) {
+			local = local->next;
+			if (local == NULL) break;
+			if (local->scope == scope) break;
+		}
+		return local;
 	}
-	return local;
+	return local->next_in_scope;
 }
 
 Var * VarFirstLocal(Var * scope)
 {
-	return VarNextLocal(scope, VARS);
+	Var * var;
+	if (scope == NULL) {
+		var = VARS;
+		if (var != NULL && var->scope != NULL) var = VarNextLocal(scope, var);
+		return var;
+	}
+	return scope->subscope;
+}
+
+Var ** VarLocals(Var * scope, UInt32 * p_count)
+/*
+Purpose:
+	Return array of variables in the scope (in the same order as FOR_EACH_LOCAL).
+	The array is owned by the scope and it is valid until some variable is added to or removed from the scope.
+*/
+{
+	Var * var;
+	Var ** arr;
+
+	*p_count = scope->subscope_count;
+	if (scope->locals == NULL && scope->subscope_count > 0) {
+		scope->locals = arr = (Var **)MemAlloc(sizeof(Var *) * scope->subscope_count);
+		for(var = scope->subscope; var != NULL; var = var->next_in_scope) {
+			*arr++ = var;
+		}
+	}
+	return scope->locals;
 }
 
 Var * NextArg(Var * proc, Var * arg, VarSubmode submode)
@@ -1342,4 +1679,4 @@ Bool VarEq(Var * left, Var * right)
 		return IntEq(l, r);
 	}
 	return false;
-}
\ No newline at end of file
+}
\ No newline at end of file
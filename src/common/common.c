@@ -28,6 +28,111 @@ Purpose:
 	return m;
 }
 
+/*
+Memory arena
+============
+
+Arena allocates memory from blocks using simple pointer bump.
+Single objects can not be released, whole arena is released at once using MemArenaReset or MemArenaFree.
+Allocations bigger than block size get their own block.
+*/
+
+#define MEM_ARENA_DEFAULT_BLOCK_SIZE 65536
+#define MEM_ARENA_ALIGN 8
+
+struct MemArenaBlockTag {
+	MemArenaBlock * next;
+	UInt8 * end;
+};
+
+#define MEM_ARENA_HEADER_SIZE ((sizeof(MemArenaBlock) + MEM_ARENA_ALIGN - 1) & ~(MEM_ARENA_ALIGN - 1))
+
+void MemArenaInit(MemArena * arena, UInt32 block_size)
+{
+	arena->block = NULL;
+	arena->top   = NULL;
+	arena->end   = NULL;
+	arena->block_size = block_size;
+}
+
+void * MemArenaAlloc(MemArena * arena, UInt32 size)
+/*
+Purpose:
+	Allocate memory from arena.
+	Allocated memory is not initialized.
+*/
+{
+	MemArenaBlock * blk;
+	UInt32 block_size;
+	UInt8 * m;
+
+	size = (size + MEM_ARENA_ALIGN - 1) & ~(MEM_ARENA_ALIGN - 1);
+
+	if (arena->top == NULL || (UInt32)(arena->end - arena->top) < size) {
+		block_size = arena->block_size;
+		if (block_size == 0) block_size = MEM_ARENA_DEFAULT_BLOCK_SIZE;
+		if (size > block_size) block_size = size;
+		blk = (MemArenaBlock *)MemAlloc(MEM_ARENA_HEADER_SIZE + block_size);
+		blk->end  = (UInt8 *)blk + MEM_ARENA_HEADER_SIZE + block_size;
+		blk->next = arena->block;
+		arena->block = blk;
+		arena->top = (UInt8 *)blk + MEM_ARENA_HEADER_SIZE;
+		arena->end = blk->end;
+	}
+
+	m = arena->top;
+	arena->top += size;
+	return m;
+}
+
+void * MemArenaAllocEmpty(MemArena * arena, UInt32 size)
+/*
+Purpose:
+	Allocate memory from arena and set it to zeroes.
+*/
+{
+	void * m = MemArenaAlloc(arena, size);
+	memset(m, 0, size);
+	return m;
+}
+
+void MemArenaReset(MemArena * arena)
+/*
+Purpose:
+	Release all objects allocated in the arena.
+	Most recently allocated block is kept, so it can be reused for next allocations.
+*/
+{
+	MemArenaBlock * blk, * next;
+
+	blk = arena->block;
+	if (blk != NULL) {
+		for(next = blk->next; next != NULL; next = blk->next) {
+			blk->next = next->next;
+			MemFree(next);
+		}
+		arena->top = (UInt8 *)blk + MEM_ARENA_HEADER_SIZE;
+		arena->end = blk->end;
+	}
+}
+
+void MemArenaFree(MemArena * arena)
+/*
+Purpose:
+	Release all objects allocated in the arena and all the memory used by arena.
+*/
+{
+	MemArenaBlock * blk, * next;
+
+	for(blk = arena->block; blk != NULL; blk = next) {
+		next = blk->next;
+		MemFree(blk);
+	}
+	arena->block = NULL;
+	arena->top   = NULL;
+	arena->end   = NULL;
+}
+
 char * StrAlloc(char * str)
 {
 	if (str != NULL) str = strdup(str);
@@ -156,6 +261,29 @@ void GetApplicationDir(char * name, char * path)
 #endif
 }
 
+#ifndef __Windows__
+#include <sys/time.h>
+#endif
+
+UInt64 TimeMicro()
+/*
+Purpose:
+	Return current time in microseconds.
+	Only differences between two returned values are meaningful.
+*/
+{
+#ifdef __Windows__
+	LARGE_INTEGER freq, cnt;
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&cnt);
+	return (UInt64)(cnt.QuadPart * 1000000 / freq.QuadPart);
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (UInt64)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
 /****************************************/
 /*Implementation of Levenshtein distance*/
 /****************************************/
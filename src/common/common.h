@@ -32,6 +32,7 @@ typedef unsigned char UInt8;
 typedef signed char Int8;
 
 typedef long long Int64;
+typedef unsigned long long UInt64;
 
 #define true 1
 #define false 0
@@ -46,6 +47,26 @@ extern void * MemAllocEmpty(long size);
 #define MemEmpty(adr, size) memset(adr, 0, size)
 #define MemMove(dest, src, size) memmove(dest, src, size)
 
+// Memory arena
+// Objects are allocated from big blocks of memory and they are all released at once.
+// Arena filled with zeroes is valid empty arena using default block size.
+
+typedef struct MemArenaBlockTag MemArenaBlock;
+
+typedef struct {
+	MemArenaBlock * block;		// current block (blocks are chained to previously allocated blocks)
+	UInt8 * top;				// first free byte in current block
+	UInt8 * end;				// end of current block
+	UInt32  block_size;			// size of allocated blocks (0 means default size)
+} MemArena;
+
+void   MemArenaInit(MemArena * arena, UInt32 block_size);
+void * MemArenaAlloc(MemArena * arena, UInt32 size);
+void * MemArenaAllocEmpty(MemArena * arena, UInt32 size);
+void   MemArenaReset(MemArena * arena);
+void   MemArenaFree(MemArena * arena);
+#define MemArenaAllocStruct(arena, TYPE) ((TYPE *)MemArenaAllocEmpty(arena, sizeof(TYPE)))
+
 // String management
 
 char * StrAlloc(char * str);
@@ -88,6 +109,10 @@ void PrintRepeat(char * text, UInt16 cnt);
 void PrintFmt(char * text, ...);
 void PrintHeader(UInt8 level, char * text, ...);
 
+// Time measurement
+
+UInt64 TimeMicro();
+
 
 //GLOBAL is used to mark global variables, so it is easy to find all of them
 #define GLOBAL